@@ -2,20 +2,105 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <charconv>
 #include <ctime>
 #include <map>
+#include <set>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <random>
 #include <algorithm>
 #include <iomanip>
 #include <cstdlib>
-#include <conio.h>
 #include <sstream>
+#include <cstdint>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <conio.h>
+#include <direct.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+#ifndef _WIN32
+// conio.h getch() - read one key without echo or waiting for Enter
+int getch() {
+    struct termios oldSettings, newSettings;
+    if(tcgetattr(STDIN_FILENO, &oldSettings) != 0) return getchar();
+    
+    newSettings = oldSettings;
+    newSettings.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &newSettings);
+    int key = getchar();
+    tcsetattr(STDIN_FILENO, TCSANOW, &oldSettings);
+    return key;
+}
+#endif
+
+// Append-only mutation log, compacted into the snapshot files on checkpoint
+const char* const JOURNAL_FILE = "bookings.journal";
+const int JOURNAL_CHECKPOINT_INTERVAL = 1000;
+
+// Incremental store written at checkpoints - a fixed-slot index into an
+// append-only data file named after its generation, e.g. flights.1.dat
+const char* const STORE_INDEX_FILE = "flights.idx";
+
+// Aircraft seat layouts beyond the built-in ones
+const char* const LAYOUT_FILE = "layouts.txt";
+
+// Fare curves beyond the built-in ones, and which curve prices the seats
+const char* const FARE_FILE = "fares.txt";
+
+// Minimum connection times at airports and the longest layover offered
+const char* const CONNECTION_FILE = "connections.txt";
+
+// Passengers waiting for a seat on a full flight, rewritten at checkpoints
+const char* const WAITLIST_FILE = "waitlist.txt";
+
+// How long a seat picked at the booking screen stays held while the
+// passenger's details are entered
+const int SEAT_HOLD_SECONDS = 300;
+
+// Largest party booked together in one group booking
+const int MAX_GROUP_SIZE = 40;
+
+// Issued tickets - rendered text appended to one archive file, located
+// through fixed-size records in its index
+const char* const TICKET_ARCHIVE_FILE = "tickets.dat";
+const char* const TICKET_INDEX_FILE = "tickets.idx";
+
 // Seat Class Enumeration
 enum SeatClass {
     ECONOMY,
-    BUSINESS
+    BUSINESS,
+    PREMIUM_ECONOMY,
+    FIRST
 };
 
 // Flight Status Enumeration
@@ -25,15 +110,588 @@ enum FlightStatus {
     CANCELED
 };
 
-// Structure for Seat
-struct Seat {
-    int seatNumber;
-    bool isBooked;
+// Outcome of a booking request
+enum BookingResult {
+    BOOKED,
+    FLIGHT_NOT_FOUND,
+    FLIGHT_CANCELED,
+    INVALID_SEAT,
+    SEAT_TAKEN,
+    DUPLICATE_BOOKING,
+    HELD,          // a hold was placed
+    SEAT_ON_HOLD,  // another customer holds the seat
+    HOLD_EXPIRED,  // the hold expired or was released before it was used
+    NOT_ENOUGH_SEATS,
+    INVALID_GROUP,
+    WAITLISTED,
+    SEATS_AVAILABLE,
+    CLASS_NOT_OFFERED
+};
+
+// When a mutation is acknowledged - once its journal record is on disk, or as
+// soon as it is applied in memory and queued for the persistence worker
+enum DurabilityPolicy {
+    SYNC_COMMIT,
+    ASYNC_COMMIT
+};
+
+string flightStatusName(FlightStatus status) {
+    switch(status) {
+        case ON_TIME: return "On Time";
+        case DELAYED: return "Delayed";
+        case CANCELED: return "Canceled";
+    }
+    return "Unknown";
+}
+
+// Status from its number in the text files and the journal
+FlightStatus flightStatusFromNumber(int value) {
+    if(value < ON_TIME || value > CANCELED) throw invalid_argument("flight status");
+    return static_cast<FlightStatus>(value);
+}
+
+string bookingResultMessage(BookingResult result) {
+    switch(result) {
+        case BOOKED: return "Booked";
+        case FLIGHT_NOT_FOUND: return "Flight not found";
+        case FLIGHT_CANCELED: return "Flight is canceled";
+        case INVALID_SEAT: return "Invalid seat number";
+        case SEAT_TAKEN: return "Seat already booked";
+        case DUPLICATE_BOOKING: return "Duplicate booking";
+        case HELD: return "Held";
+        case SEAT_ON_HOLD: return "Seat is on hold for another customer";
+        case HOLD_EXPIRED: return "Seat hold expired";
+        case NOT_ENOUGH_SEATS: return "Not enough seats left in one cabin";
+        case INVALID_GROUP: return "A group needs 1 to " + to_string(MAX_GROUP_SIZE) + " passengers";
+        case WAITLISTED: return "Waitlisted";
+        case SEATS_AVAILABLE: return "Seats are still available in this class";
+        case CLASS_NOT_OFFERED: return "Class not offered on this flight";
+    }
+    return "Unknown";
+}
+
+string seatClassName(SeatClass type) {
+    switch(type) {
+        case ECONOMY: return "Economy";
+        case BUSINESS: return "Business";
+        case PREMIUM_ECONOMY: return "Premium Economy";
+        case FIRST: return "First";
+    }
+    return "Unknown";
+}
+
+// Cabins are shown from the front of the aircraft - first class down to economy
+int seatClassRank(SeatClass type) {
+    switch(type) {
+        case FIRST: return 0;
+        case BUSINESS: return 1;
+        case PREMIUM_ECONOMY: return 2;
+        case ECONOMY: return 3;
+    }
+    return 4;
+}
+
+// Class from its name or first letter, e.g. "Business" or "B"
+bool parseSeatClass(const string& text, SeatClass& type) {
+    if(text.empty()) return false;
+    switch(toupper(text[0])) {
+        case 'E': type = ECONOMY; return true;
+        case 'B': type = BUSINESS; return true;
+        case 'P': type = PREMIUM_ECONOMY; return true;
+        case 'F': type = FIRST; return true;
+    }
+    return false;
+}
+
+// Seat inventory limits - booked seats are kept in a bitmap of SEAT_WORDS words
+const int MAX_SEATS = 512;
+const int SEAT_WORDS = MAX_SEATS / 64;
+const int MAX_CABINS = 4;
+
+inline int popcount64(uint64_t word) {
+#ifdef _MSC_VER
+    return static_cast<int>(__popcnt64(word));
+#else
+    return __builtin_popcountll(word);
+#endif
+}
+
+// Index of the lowest set bit; word must not be 0
+inline int lowestBit64(uint64_t word) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// Structure for Cabin - a contiguous range of seat numbers sharing a class and base price
+struct Cabin {
     SeatClass type;
+    int firstSeat;
+    int seatCount;
     double basePrice;
+    vector<int> blocks; // seats between aisles, e.g. {3, 3}
+    int seatsPerRow;
+    int firstRow;
+    
+    Cabin() : type(ECONOMY), firstSeat(0), seatCount(0), basePrice(0), seatsPerRow(0), firstRow(0) {}
+};
+
+// Where a seat sits inside its aircraft
+struct SeatPosition {
+    uint8_t cabin;
+    uint8_t column;
+    uint16_t row;
+};
+
+// Structure for SeatLayout - a named aircraft configuration shared by every flight using it
+struct SeatLayout {
+    string id;
+    vector<Cabin> cabins;
+    vector<SeatPosition> seatTable; // indexed by seat number, entry 0 unused
+    int seatCount;
+    
+    SeatLayout() : seatCount(0) {}
+    
+    const Cabin& cabinOf(int seatNum) const {
+        return cabins[seatTable[seatNum].cabin];
+    }
+    
+    // Row number and column letter, e.g. "12C"
+    string seatLabel(int seatNum) const {
+        const SeatPosition& position = seatTable[seatNum];
+        return to_string(position.row) + static_cast<char>('A' + position.column);
+    }
+    
+    // Number seats front to back and fill in the seat table
+    void build() {
+        seatCount = 0;
+        int row = 1;
+        seatTable.assign(1, SeatPosition());
+        
+        for(size_t c = 0; c < cabins.size(); c++) {
+            Cabin& cabin = cabins[c];
+            cabin.seatsPerRow = 0;
+            for(int block : cabin.blocks) cabin.seatsPerRow += block;
+            cabin.firstSeat = seatCount + 1;
+            cabin.firstRow = row;
+            
+            for(int i = 0; i < cabin.seatCount; i++) {
+                SeatPosition position;
+                position.cabin = static_cast<uint8_t>(c);
+                position.row = static_cast<uint16_t>(row + i / cabin.seatsPerRow);
+                position.column = static_cast<uint8_t>(i % cabin.seatsPerRow);
+                seatTable.push_back(position);
+            }
+            
+            seatCount += cabin.seatCount;
+            row += (cabin.seatCount + cabin.seatsPerRow - 1) / cabin.seatsPerRow;
+        }
+    }
+};
+
+// Registry of aircraft layouts. Built-in layouts are always available and
+// more can be defined in layouts.txt, one per line:
+//   ID|class,basePrice,blocks,seats|...   e.g.  A320|B,2500,2-2,12|E,1000,3-3,168
+// Classes are F (first), B (business), P (premium economy) and E (economy).
+class LayoutRegistry {
+private:
+    deque<SeatLayout> layouts; // deque keeps layout addresses stable as it grows
+    unordered_map<string, const SeatLayout*> byId;
+    size_t builtInCount;
+    int customCount;
+    
+    static char classCode(SeatClass type) {
+        switch(type) {
+            case ECONOMY: return 'E';
+            case BUSINESS: return 'B';
+            case PREMIUM_ECONOMY: return 'P';
+            case FIRST: return 'F';
+        }
+        return 'E';
+    }
+    
+public:
+    LayoutRegistry() : builtInCount(0), customCount(0) {
+        // 30 economy seats and 10 business class seats - the original aircraft
+        define("STD40|E,1000,3-3,30|B,2500,2-1-2,10");
+        define("A320|B,2500,2-2,12|E,1000,3-3,168");
+        define("A321|B,2500,2-2,20|P,1600,3-3,24|E,1000,3-3,156");
+        define("B787|B,2500,1-2-1,28|P,1600,2-3-2,35|E,1000,3-3-3,198");
+        define("B777|F,6000,1-2-1,8|B,2500,2-3-2,42|P,1600,2-4-2,48|E,1000,3-4-3,300");
+        builtInCount = layouts.size();
+    }
+    
+    const SeatLayout* defaultLayout() const {
+        return find("STD40");
+    }
+    
+    const SeatLayout* find(const string& id) const {
+        auto it = byId.find(id);
+        return (it != byId.end()) ? it->second : nullptr;
+    }
+    
+    const deque<SeatLayout>& all() const {
+        return layouts;
+    }
+    
+    const SeatLayout* add(const SeatLayout& layout) {
+        if(layout.cabins.empty() || layout.cabins.size() > MAX_CABINS || byId.count(layout.id)) return nullptr;
+        
+        SeatLayout built = layout;
+        built.build();
+        if(built.seatCount > MAX_SEATS) return nullptr;
+        
+        layouts.push_back(built);
+        byId[built.id] = &layouts.back();
+        return &layouts.back();
+    }
+    
+    // Parse and register one layout definition line
+    const SeatLayout* define(const string& line) {
+        stringstream ss(line);
+        SeatLayout layout;
+        getline(ss, layout.id, '|');
+        
+        string cabinStr;
+        while(getline(ss, cabinStr, '|')) {
+            stringstream cabinSS(cabinStr);
+            string classStr, priceStr, blocksStr, seatsStr;
+            getline(cabinSS, classStr, ',');
+            getline(cabinSS, priceStr, ',');
+            getline(cabinSS, blocksStr, ',');
+            getline(cabinSS, seatsStr, ',');
+            
+            Cabin cabin;
+            if(!parseSeatClass(classStr, cabin.type)) return nullptr;
+            try {
+                cabin.basePrice = stod(priceStr);
+                cabin.seatCount = stoi(seatsStr);
+                stringstream blockSS(blocksStr);
+                string block;
+                while(getline(blockSS, block, '-')) {
+                    cabin.blocks.push_back(stoi(block));
+                }
+            } catch(const exception&) {
+                return nullptr;
+            }
+            
+            int seatsPerRow = 0;
+            for(int block : cabin.blocks) seatsPerRow += block;
+            if(cabin.seatCount <= 0 || seatsPerRow <= 0) return nullptr;
+            
+            layout.cabins.push_back(cabin);
+        }
+        
+        return layout.id.empty() ? nullptr : add(layout);
+    }
+    
+    static string describe(const SeatLayout& layout) {
+        stringstream ss;
+        ss << layout.id;
+        for(const auto& cabin : layout.cabins) {
+            ss << "|" << classCode(cabin.type) << "," << cabin.basePrice << ",";
+            for(size_t i = 0; i < cabin.blocks.size(); i++) {
+                ss << (i ? "-" : "") << cabin.blocks[i];
+            }
+            ss << "," << cabin.seatCount;
+        }
+        return ss.str();
+    }
+    
+    // Every layout that is not built in, one line each for layouts.txt, so
+    // custom and imported ones survive a restart. Empty when there are none.
+    string customDefinitions() const {
+        string text;
+        for(size_t i = builtInCount; i < layouts.size(); i++) {
+            text += describe(layouts[i]);
+            text += '\n';
+        }
+        return text;
+    }
+    
+    void loadFile(const char* path) {
+        ifstream file(path);
+        string line;
+        while(getline(file, line)) {
+            if(line.empty() || find(line.substr(0, line.find('|')))) continue;
+            if(!define(line)) {
+                cerr << "Ignoring invalid seat layout: " << line << endl;
+                continue;
+            }
+            
+            // Keep generated names unique after reloading them
+            if(line.compare(0, 6, "CUSTOM") == 0) {
+                customCount = max(customCount, atoi(line.c_str() + 6));
+            }
+        }
+    }
+    
+    // Find the layout whose cabins match per-seat data from older files,
+    // registering a custom one when none does
+    const SeatLayout* match(const vector<Cabin>& cabins) {
+        for(const auto& layout : layouts) {
+            if(layout.cabins.size() != cabins.size()) continue;
+            
+            bool same = true;
+            for(size_t i = 0; i < cabins.size() && same; i++) {
+                same = layout.cabins[i].type == cabins[i].type &&
+                       layout.cabins[i].seatCount == cabins[i].seatCount &&
+                       layout.cabins[i].basePrice == cabins[i].basePrice;
+            }
+            if(same) return &layout;
+        }
+        
+        SeatLayout layout;
+        layout.id = "CUSTOM" + to_string(++customCount);
+        layout.cabins = cabins;
+        for(auto& cabin : layout.cabins) {
+            if(cabin.blocks.empty()) cabin.blocks = {3, 3};
+        }
+        
+        const SeatLayout* added = add(layout);
+        return added ? added : defaultLayout();
+    }
+};
+
+LayoutRegistry& seatLayouts() {
+    static LayoutRegistry registry;
+    return registry;
+}
+
+typedef uint32_t AirportId;
+const AirportId NO_AIRPORT = 0; // the empty name, e.g. a flight with no via
+
+// Airport and city names interned to small integer IDs. Flights store IDs,
+// route filters compare them, and each name is stored once in the store.
+// Names are never removed, so an ID stays valid for the life of the process.
+class AirportDictionary {
+private:
+    deque<string> names; // deque keeps name references stable as it grows
+    unordered_map<string, AirportId> ids;
+    mutable shared_mutex lock;
+    
+public:
+    AirportDictionary() {
+        names.push_back("");
+        ids[""] = NO_AIRPORT;
+    }
+    
+    // ID for a name, adding the name if it is new
+    AirportId intern(const string& name) {
+        {
+            shared_lock<shared_mutex> guard(lock);
+            auto it = ids.find(name);
+            if(it != ids.end()) return it->second;
+        }
+        
+        unique_lock<shared_mutex> guard(lock);
+        auto it = ids.find(name);
+        if(it != ids.end()) return it->second;
+        
+        AirportId id = static_cast<AirportId>(names.size());
+        names.push_back(name);
+        ids[name] = id;
+        return id;
+    }
+    
+    // Lookup without adding - a name nobody uses matches no flight
+    bool find(const string& name, AirportId& id) const {
+        shared_lock<shared_mutex> guard(lock);
+        auto it = ids.find(name);
+        if(it == ids.end()) return false;
+        id = it->second;
+        return true;
+    }
+    
+    const string& name(AirportId id) const {
+        shared_lock<shared_mutex> guard(lock);
+        return names[id];
+    }
+    
+    size_t size() const {
+        shared_lock<shared_mutex> guard(lock);
+        return names.size();
+    }
+};
+
+AirportDictionary& airports() {
+    static AirportDictionary dictionary;
+    return dictionary;
+}
+
+// Parse the digits of text[begin, end) - false if empty or not all digits
+bool parseNumber(const string& text, size_t begin, size_t end, int& value) {
+    if(begin >= end || end - begin > 4) return false;
+    value = 0;
+    for(size_t i = begin; i < end; i++) {
+        if(!isdigit(static_cast<unsigned char>(text[i]))) return false;
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+// Calendar date held as days since 01/01/1970, read and written as DD/MM/YYYY.
+// A date that failed to parse is invalid and prints as an empty string.
+struct FlightDate {
+    static const int32_t INVALID = INT32_MIN;
+    int32_t day;
+    
+    FlightDate() : day(INVALID) {}
+    explicit FlightDate(int32_t d) : day(d) {}
+    
+    bool valid() const { return day != INVALID; }
     
-    Seat(int num, SeatClass t) : seatNumber(num), isBooked(false), type(t) {
-        basePrice = (t == ECONOMY) ? 1000.0 : 2500.0;
+    static bool isLeapYear(int year) {
+        return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    }
+    
+    static int daysInMonth(int year, int month) {
+        static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+        return (month == 2 && isLeapYear(year)) ? 29 : days[month - 1];
+    }
+    
+    // Days since 01/01/1970 in the proleptic Gregorian calendar
+    static FlightDate fromCivil(int year, int month, int dayOfMonth) {
+        year -= month <= 2;
+        int era = (year >= 0 ? year : year - 399) / 400;
+        int yearOfEra = year - era * 400;
+        int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + dayOfMonth - 1;
+        int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+        return FlightDate(era * 146097 + dayOfEra - 719468);
+    }
+    
+    void toCivil(int& year, int& month, int& dayOfMonth) const {
+        int days = day + 719468;
+        int era = (days >= 0 ? days : days - 146096) / 146097;
+        int dayOfEra = days - era * 146097;
+        int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+        int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+        int shiftedMonth = (5 * dayOfYear + 2) / 153;
+        dayOfMonth = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+        month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+        year = yearOfEra + era * 400 + (month <= 2);
+    }
+    
+    // Accepts DD/MM/YYYY, also with single-digit day or month
+    static bool parse(const string& text, FlightDate& date) {
+        size_t first = text.find('/');
+        size_t second = (first == string::npos) ? string::npos : text.find('/', first + 1);
+        if(second == string::npos) return false;
+        
+        int dayOfMonth, month, year;
+        if(!parseNumber(text, 0, first, dayOfMonth) ||
+           !parseNumber(text, first + 1, second, month) ||
+           !parseNumber(text, second + 1, text.size(), year) ||
+           month < 1 || month > 12 || dayOfMonth < 1 || dayOfMonth > daysInMonth(year, month)) {
+            return false;
+        }
+        date = fromCivil(year, month, dayOfMonth);
+        return true;
+    }
+    
+    string toString() const {
+        if(!valid()) return "";
+        int year, month, dayOfMonth;
+        toCivil(year, month, dayOfMonth);
+        char buffer[40];
+        snprintf(buffer, sizeof(buffer), "%02d/%02d/%04d", dayOfMonth, month, year);
+        return buffer;
+    }
+    
+    bool operator==(const FlightDate& other) const { return day == other.day; }
+    bool operator!=(const FlightDate& other) const { return day != other.day; }
+};
+
+// Time of day held as minutes since midnight, read and written as HH:MM
+struct FlightTime {
+    static const int16_t INVALID = -1;
+    int16_t minutes;
+    
+    FlightTime() : minutes(INVALID) {}
+    explicit FlightTime(int m) : minutes(static_cast<int16_t>(m)) {}
+    
+    bool valid() const { return minutes != INVALID; }
+    
+    // Accepts HH:MM or H:MM
+    static bool parse(const string& text, FlightTime& time) {
+        size_t colon = text.find(':');
+        int hours, mins;
+        if(colon == string::npos ||
+           !parseNumber(text, 0, colon, hours) ||
+           !parseNumber(text, colon + 1, text.size(), mins) ||
+           colon + 3 != text.size() || hours > 23 || mins > 59) {
+            return false;
+        }
+        time = FlightTime(hours * 60 + mins);
+        return true;
+    }
+    
+    string toString() const {
+        if(!valid()) return "";
+        char buffer[16];
+        snprintf(buffer, sizeof(buffer), "%02d:%02d", minutes / 60, minutes % 60);
+        return buffer;
+    }
+    
+    bool operator==(const FlightTime& other) const { return minutes == other.minutes; }
+    bool operator!=(const FlightTime& other) const { return minutes != other.minutes; }
+};
+
+ostream& operator<<(ostream& out, const FlightDate& date) {
+    return out << date.toString();
+}
+
+ostream& operator<<(ostream& out, const FlightTime& time) {
+    return out << time.toString();
+}
+
+// Per-seat inventory from the text format, placed by seat number and then
+// gathered into cabins so the matching layout can be looked up. Seats may be
+// listed in any order; a list that skips or repeats a number, or needs more
+// cabins than a layout has, is rejected rather than losing its bookings.
+struct LegacySeatList {
+    struct Seat {
+        bool listed;
+        bool booked;
+        SeatClass type;
+        double price;
+    };
+    
+    vector<Seat> seats; // by seat number - 1
+    vector<Cabin> cabins;
+    vector<int> booked;
+    
+    void add(int seatNum, bool isBooked, SeatClass type, double price) {
+        if(seatNum < 1 || seatNum > MAX_SEATS) throw invalid_argument("seat number");
+        if(static_cast<size_t>(seatNum) > seats.size()) seats.resize(seatNum, Seat{false, false, ECONOMY, 0});
+        
+        Seat& seat = seats[seatNum - 1];
+        if(seat.listed) throw invalid_argument("seat listed twice");
+        seat = Seat{true, isBooked, type, price};
+    }
+    
+    // Fill cabins and booked from the seats added
+    void finish() {
+        for(size_t i = 0; i < seats.size(); i++) {
+            const Seat& seat = seats[i];
+            if(!seat.listed) throw invalid_argument("seat missing");
+            
+            if(cabins.empty() || cabins.back().type != seat.type || cabins.back().basePrice != seat.price) {
+                if(cabins.size() == MAX_CABINS) throw invalid_argument("too many cabins");
+                Cabin cabin;
+                cabin.type = seat.type;
+                cabin.basePrice = seat.price;
+                cabin.seatCount = 0;
+                cabins.push_back(cabin);
+            }
+            
+            cabins.back().seatCount++;
+            if(seat.booked) booked.push_back(static_cast<int>(i) + 1);
+        }
     }
 };
 
@@ -47,311 +705,5211 @@ struct Passenger {
     
     Passenger() {}
     
+    // The ticket number is assigned by the booking system when the seat is booked
     Passenger(string n, string e, string p, int s) : 
-        name(n), email(e), phone(p), seatNumber(s) {
-        // Generate random ticket number
-        ticketNumber = generateTicketNumber();
+        name(n), email(e), phone(p), seatNumber(s) {}
+};
+
+// Index of a passenger in a PassengerStore
+typedef uint32_t PassengerId;
+
+// Columnar passenger storage. Each field is a column split into fixed-size
+// blocks, and the strings live in an arena of fixed-size chunks, so a
+// passenger costs four 32-bit string references and a seat number instead of
+// four std::strings. Blocks and chunks never move once allocated, so bookings
+// on different flights can add passengers while other flights are read.
+// IDs of removed passengers are reused; the strings they leave behind are
+// reclaimed by compact().
+class PassengerStore {
+private:
+    static const size_t BLOCK_BITS = 16;
+    static const size_t BLOCK_SIZE = size_t(1) << BLOCK_BITS;
+    static const size_t MAX_BLOCKS = 1 << 15;
+    static const size_t CHUNK_BITS = 20;
+    static const size_t CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+    static const size_t MAX_CHUNKS = 1 << 14; // string references count 4-byte units, so 16 GB of strings
+    
+    struct Block {
+        uint32_t name[BLOCK_SIZE];
+        uint32_t email[BLOCK_SIZE];
+        uint32_t phone[BLOCK_SIZE];
+        uint32_t ticketNumber[BLOCK_SIZE];
+        int32_t seatNumber[BLOCK_SIZE];
+        uint32_t flightSlot[BLOCK_SIZE];
+    };
+    
+    unique_ptr<Block*[]> blocks;
+    unique_ptr<char*[]> chunks;
+    
+    // Guards allocation - the fields below and new blocks and chunks
+    mutable mutex lock;
+    PassengerId nextId;
+    vector<PassengerId> freeIds;
+    size_t blockCount;
+    size_t chunkCount;
+    size_t chunkUsed;   // bytes used in the last chunk
+    uint64_t deadBytes; // arena bytes held only by removed passengers
+    
+    // Strings are stored as a 32-bit length and the bytes, padded to 4 bytes
+    static size_t stringBytes(size_t length) {
+        return (sizeof(uint32_t) + length + 3) & ~size_t(3);
     }
     
-    string generateTicketNumber() {
-        stringstream ss;
-        ss << "TKT" << rand() % 10000 << time(0) % 10000;
-        return ss.str();
+    uint32_t addString(string_view str) {
+        if(str.size() > CHUNK_SIZE - sizeof(uint32_t)) str = str.substr(0, CHUNK_SIZE - sizeof(uint32_t));
+        size_t bytes = stringBytes(str.size());
+        
+        if(chunkCount == 0 || chunkUsed + bytes > CHUNK_SIZE) {
+            if(chunkCount == MAX_CHUNKS) {
+                cerr << "Passenger store is full!" << endl;
+                abort();
+            }
+            if(!chunks[chunkCount]) chunks[chunkCount] = new char[CHUNK_SIZE];
+            chunkCount++;
+            chunkUsed = 0;
+        }
+        
+        char* at = chunks[chunkCount - 1] + chunkUsed;
+        uint32_t length = static_cast<uint32_t>(str.size());
+        memcpy(at, &length, sizeof(length));
+        memcpy(at + sizeof(length), str.data(), str.size());
+        uint32_t ref = static_cast<uint32_t>(((chunkCount - 1) << (CHUNK_BITS - 2)) | (chunkUsed >> 2));
+        chunkUsed += bytes;
+        return ref;
+    }
+    
+    string_view stringAt(uint32_t ref) const {
+        const char* at = chunks[ref >> (CHUNK_BITS - 2)] + (static_cast<size_t>(ref & ((1 << (CHUNK_BITS - 2)) - 1)) << 2);
+        uint32_t length;
+        memcpy(&length, at, sizeof(length));
+        return string_view(at + sizeof(length), length);
+    }
+    
+    Block& blockOf(PassengerId id) const {
+        return *blocks[id >> BLOCK_BITS];
+    }
+    
+    static size_t slotOf(PassengerId id) {
+        return id & (BLOCK_SIZE - 1);
+    }
+    
+public:
+    PassengerStore() : blocks(new Block*[MAX_BLOCKS]()), chunks(new char*[MAX_CHUNKS]()),
+        nextId(0), blockCount(0), chunkCount(0), chunkUsed(0), deadBytes(0) {}
+    
+    PassengerStore(const PassengerStore&) = delete;
+    PassengerStore& operator=(const PassengerStore&) = delete;
+    
+    ~PassengerStore() {
+        for(size_t i = 0; i < MAX_BLOCKS && blocks[i]; i++) delete blocks[i];
+        for(size_t i = 0; i < MAX_CHUNKS && chunks[i]; i++) delete[] chunks[i];
+    }
+    
+    PassengerId add(string_view name, string_view email, string_view phone, string_view ticketNumber, int seatNumber) {
+        lock_guard<mutex> guard(lock);
+        PassengerId id;
+        if(!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        } else {
+            if(nextId == MAX_BLOCKS * BLOCK_SIZE) {
+                cerr << "Passenger store is full!" << endl;
+                abort();
+            }
+            id = nextId++;
+            if((id >> BLOCK_BITS) == blockCount) {
+                if(!blocks[blockCount]) blocks[blockCount] = new Block;
+                blockCount++;
+            }
+        }
+        
+        Block& block = blockOf(id);
+        size_t slot = slotOf(id);
+        block.name[slot] = addString(name);
+        block.email[slot] = addString(email);
+        block.phone[slot] = addString(phone);
+        block.ticketNumber[slot] = addString(ticketNumber);
+        block.seatNumber[slot] = seatNumber;
+        block.flightSlot[slot] = 0;
+        return id;
+    }
+    
+    PassengerId add(const Passenger& passenger) {
+        return add(passenger.name, passenger.email, passenger.phone, passenger.ticketNumber, passenger.seatNumber);
+    }
+    
+    void remove(PassengerId id) {
+        lock_guard<mutex> guard(lock);
+        deadBytes += stringBytes(name(id).size()) + stringBytes(email(id).size()) +
+                     stringBytes(phone(id).size()) + stringBytes(ticketNumber(id).size());
+        freeIds.push_back(id);
+    }
+    
+    // Views stay valid until the passenger is removed or the store is compacted
+    string_view name(PassengerId id) const { return stringAt(blockOf(id).name[slotOf(id)]); }
+    string_view email(PassengerId id) const { return stringAt(blockOf(id).email[slotOf(id)]); }
+    string_view phone(PassengerId id) const { return stringAt(blockOf(id).phone[slotOf(id)]); }
+    string_view ticketNumber(PassengerId id) const { return stringAt(blockOf(id).ticketNumber[slotOf(id)]); }
+    int seatNumber(PassengerId id) const { return blockOf(id).seatNumber[slotOf(id)]; }
+    
+    // Slot of the flight the passenger is booked on, so a passenger ID alone
+    // leads back to its booking
+    uint32_t flightSlot(PassengerId id) const { return blockOf(id).flightSlot[slotOf(id)]; }
+    void setFlightSlot(PassengerId id, uint32_t slot) { blockOf(id).flightSlot[slotOf(id)] = slot; }
+    
+    Passenger get(PassengerId id) const {
+        Passenger passenger(string(name(id)), string(email(id)), string(phone(id)), seatNumber(id));
+        passenger.ticketNumber = string(ticketNumber(id));
+        return passenger;
+    }
+    
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        return nextId - freeIds.size();
+    }
+
+    
+    // Bytes held by columns and the arena
+    uint64_t memoryBytes() const {
+        lock_guard<mutex> guard(lock);
+        return blockCount * sizeof(Block) + chunkCount * CHUNK_SIZE + freeIds.capacity() * sizeof(PassengerId);
+    }
+    
+    // Worth compacting once removed passengers hold most of the arena
+    bool compactDue() const {
+        lock_guard<mutex> guard(lock);
+        return deadBytes > 4 * CHUNK_SIZE && deadBytes * 2 > static_cast<uint64_t>(chunkCount) * CHUNK_SIZE;
+    }
+    
+    // Copy the strings of live passengers into a fresh arena. IDs do not
+    // change, but every view handed out before is invalidated, so the caller
+    // must have every reader locked out.
+    void compact() {
+        lock_guard<mutex> guard(lock);
+        vector<bool> removed(nextId, false);
+        for(PassengerId id : freeIds) removed[id] = true;
+        
+        unique_ptr<char*[]> oldChunks(new char*[MAX_CHUNKS]());
+        oldChunks.swap(chunks);
+        chunkCount = 0;
+        chunkUsed = 0;
+        
+        auto relocate = [&](uint32_t& ref) {
+            const char* at = oldChunks[ref >> (CHUNK_BITS - 2)] + (static_cast<size_t>(ref & ((1 << (CHUNK_BITS - 2)) - 1)) << 2);
+            uint32_t length;
+            memcpy(&length, at, sizeof(length));
+            ref = addString(string_view(at + sizeof(length), length));
+        };
+        for(PassengerId id = 0; id < nextId; id++) {
+            if(removed[id]) continue;
+            Block& block = blockOf(id);
+            size_t slot = slotOf(id);
+            relocate(block.name[slot]);
+            relocate(block.email[slot]);
+            relocate(block.phone[slot]);
+            relocate(block.ticketNumber[slot]);
+        }
+        
+        for(size_t i = 0; i < MAX_CHUNKS && oldChunks[i]; i++) delete[] oldChunks[i];
+        deadBytes = 0;
+    }
+    
+    // Forget every passenger, keeping the memory for reuse
+    void clear() {
+        lock_guard<mutex> guard(lock);
+        nextId = 0;
+        freeIds.clear();
+        blockCount = 0;
+        chunkCount = 0;
+        chunkUsed = 0;
+        deadBytes = 0;
     }
 };
 
 // Structure for Flight
 struct Flight {
     string flightNumber;
-    string source;
-    string destination;
-    string sourceTime;
-    string destinationTime;
-    string date;
+    AirportId source;
+    AirportId destination;
+    FlightTime sourceTime;
+    FlightTime destinationTime;
+    FlightDate date;
     double basePrice;
-    string via;
+    AirportId via;
     int stops;
-    vector<Seat> seats;
-    vector<Passenger> passengers;
+    vector<PassengerId> passengers; // in the booking system's PassengerStore
     FlightStatus status;
+    uint32_t slot; // stable ID embedded in ticket numbers, 0 until the flight is added
+    bool dirty;    // changed since the last checkpoint wrote it to the store
+    
+    // Seat inventory - the layout is shared, bit (n - 1) of bookedSeats is set while seat n is booked
+    const SeatLayout* layout;
+    int seatCount;
+    int bookedCount;
+    int cabinBooked[MAX_CABINS];
+    uint64_t bookedSeats[SEAT_WORDS];
+    uint64_t heldSeats[SEAT_WORDS]; // seats under a hold - in memory only, never saved
     
-    Flight() : stops(0), basePrice(0), status(ON_TIME) {}
+    Flight() : source(NO_AIRPORT), destination(NO_AIRPORT), basePrice(0), via(NO_AIRPORT),
+        stops(0), status(ON_TIME), slot(0), dirty(false) {
+        setLayout(seatLayouts().defaultLayout());
+    }
     
     Flight(string fnum, string src, string dest, string srcTime, string destTime, 
            string d, double price, string v, int st) : 
-        flightNumber(fnum), source(src), destination(dest), sourceTime(srcTime), 
-        destinationTime(destTime), date(d), basePrice(price), via(v), stops(st), status(ON_TIME) {
+        flightNumber(fnum), source(airports().intern(src)), destination(airports().intern(dest)),
+        basePrice(price), via(airports().intern(v)), stops(st), status(ON_TIME), slot(0), dirty(false) {
+        FlightTime::parse(srcTime, sourceTime);
+        FlightTime::parse(destTime, destinationTime);
+        FlightDate::parse(d, date);
+        setLayout(seatLayouts().defaultLayout());
+    }
+    
+    // Chronological sort key - day and minute of departure
+    int64_t departureKey() const {
+        return static_cast<int64_t>(date.day) * 1440 + (sourceTime.valid() ? sourceTime.minutes : 0);
+    }
+    
+    // Arrival in the same minutes; an arrival time before the departure time is on the next day
+    int64_t arrivalKey() const {
+        int64_t arrival = static_cast<int64_t>(date.day) * 1440 + (destinationTime.valid() ? destinationTime.minutes : 0);
+        return (destinationTime.minutes < sourceTime.minutes) ? arrival + 1440 : arrival;
+    }
+    
+    const string& sourceName() const { return airports().name(source); }
+    const string& destinationName() const { return airports().name(destination); }
+    const string& viaName() const { return airports().name(via); }
+    
+    // Switch to a layout with every seat available
+    void setLayout(const SeatLayout* newLayout) {
+        layout = newLayout;
+        seatCount = layout->seatCount;
+        bookedCount = 0;
+        memset(cabinBooked, 0, sizeof(cabinBooked));
+        memset(bookedSeats, 0, sizeof(bookedSeats));
+        memset(heldSeats, 0, sizeof(heldSeats));
+    }
+    
+    // Recompute the occupancy counters from the bitmap after it was loaded directly
+    void recountSeats() {
+        bookedCount = 0;
+        for(size_t i = 0; i < layout->cabins.size(); i++) {
+            cabinBooked[i] = countBookedSeats(layout->cabins[i].firstSeat, layout->cabins[i].seatCount);
+            bookedCount += cabinBooked[i];
+        }
+    }
+    
+    int countBookedSeats(int firstSeat, int count) const {
+        int booked = 0;
+        int bit = firstSeat - 1;
+        int end = bit + count;
+        
+        while(bit < end) {
+            int offset = bit & 63;
+            int span = min(64 - offset, end - bit);
+            uint64_t mask = (span == 64) ? ~0ULL : (((1ULL << span) - 1) << offset);
+            booked += popcount64(bookedSeats[bit >> 6] & mask);
+            bit += span;
+        }
+        return booked;
+    }
+    
+    // Free seats of a range, a word of the bitmaps at a time - bit i of the
+    // result stands for seat bit + i + 1, and bits past the range are clear
+    uint64_t freeSeatBits(int bit, int span) const {
+        int word = bit >> 6;
+        uint64_t free = ~(bookedSeats[word] | heldSeats[word]) >> (bit & 63);
+        return (span == 64) ? free : (free & ((1ULL << span) - 1));
+    }
+    
+    // First seat of the first run of length adjacent free seats in the
+    // range, or 0. Runs are followed across word boundaries.
+    int findFreeRun(int firstSeat, int count, int length) const {
+        int bit = firstSeat - 1;
+        int end = bit + count;
+        int runStart = 0, run = 0;
+        
+        while(bit < end) {
+            int span = min(64 - (bit & 63), end - bit);
+            uint64_t free = freeSeatBits(bit, span);
+            
+            // Step over the word's free and taken stretches a stretch at a time
+            int pos = 0;
+            while(pos < span) {
+                uint64_t rest = free >> pos;
+                if(rest & 1) {
+                    int stretch = (~rest == 0) ? 64 : lowestBit64(~rest);
+                    if(run == 0) runStart = bit + pos;
+                    run += stretch;
+                    if(run >= length) return runStart + 1;
+                    pos += stretch;
+                } else {
+                    run = 0;
+                    pos = (rest == 0) ? span : pos + lowestBit64(rest);
+                }
+            }
+            bit += span;
+        }
+        return 0;
+    }
+    
+    // Append up to length free seats of the range, front first; returns how many
+    int collectFreeSeats(int firstSeat, int count, int length, vector<int>& seats) const {
+        int bit = firstSeat - 1;
+        int end = bit + count;
+        int found = 0;
         
-        // Initialize seats - 30 economy seats and 10 business class seats
-        for(int i = 1; i <= 30; i++) {
-            seats.push_back(Seat(i, ECONOMY));
+        while(bit < end && found < length) {
+            int span = min(64 - (bit & 63), end - bit);
+            for(uint64_t free = freeSeatBits(bit, span); free && found < length; free &= free - 1, found++) {
+                seats.push_back(bit + lowestBit64(free) + 1);
+            }
+            bit += span;
         }
-        for(int i = 31; i <= 40; i++) {
-            seats.push_back(Seat(i, BUSINESS));
+        return found;
+    }
+    
+    bool isSeatBooked(int seatNum) const {
+        return (bookedSeats[(seatNum - 1) >> 6] >> ((seatNum - 1) & 63)) & 1;
+    }
+    
+    void markSeatBooked(int seatNum) {
+        if(seatNum < 1 || seatNum > seatCount || isSeatBooked(seatNum)) return;
+        
+        bookedSeats[(seatNum - 1) >> 6] |= 1ULL << ((seatNum - 1) & 63);
+        cabinBooked[layout->seatTable[seatNum].cabin]++;
+        bookedCount++;
+    }
+    
+    void markSeatAvailable(int seatNum) {
+        if(seatNum < 1 || seatNum > seatCount || !isSeatBooked(seatNum)) return;
+        
+        bookedSeats[(seatNum - 1) >> 6] &= ~(1ULL << ((seatNum - 1) & 63));
+        cabinBooked[layout->seatTable[seatNum].cabin]--;
+        bookedCount--;
+    }
+    
+    bool isSeatHeld(int seatNum) const {
+        return (heldSeats[(seatNum - 1) >> 6] >> ((seatNum - 1) & 63)) & 1;
+    }
+    
+    void setSeatHeld(int seatNum, bool held) {
+        if(held) heldSeats[(seatNum - 1) >> 6] |= 1ULL << ((seatNum - 1) & 63);
+        else heldSeats[(seatNum - 1) >> 6] &= ~(1ULL << ((seatNum - 1) & 63));
+    }
+    
+    // Neither booked nor held
+    bool isSeatAvailable(int seatNum) const {
+        return seatNum >= 1 && seatNum <= seatCount && !isSeatBooked(seatNum) && !isSeatHeld(seatNum);
+    }
+    
+    string getSeatType(int seatNum) const {
+        if(seatNum < 1 || seatNum > seatCount) return "Unknown";
+        return seatClassName(layout->cabinOf(seatNum).type);
+    }
+};
+
+// Dynamic pricing. A fare curve scales a cabin's base fare by a factor that
+// grows with occupancy - of the whole flight or, for per-cabin curves, of
+// the seat's own cabin. Linear curves add slope times the occupancy; step
+// curves use the factor of the highest occupancy threshold reached. The
+// occupancy counters are kept by markSeatBooked and markSeatAvailable, so a
+// quote costs one curve evaluation per cabin, however many seats it covers.
+struct FareCurve {
+    string id;
+    bool perCabin;
+    double slope;
+    vector<pair<double, double>> steps; // (occupancy, factor) by ascending occupancy; empty for linear curves
+    
+    FareCurve() : perCabin(false), slope(0) {}
+    
+    double factor(int booked, int seats) const {
+        double occupancy = seats ? static_cast<double>(booked) / seats : 0.0;
+        if(steps.empty()) return 1.0 + occupancy * slope;
+        
+        double result = 1.0;
+        for(const auto& step : steps) {
+            if(occupancy < step.first) break;
+            result = step.second;
+        }
+        return result;
+    }
+    
+    double quoteSeat(const Flight& flight, int seatNum) const {
+        if(seatNum < 1 || seatNum > flight.seatCount) return flight.basePrice;
+        
+        int cabinIndex = flight.layout->seatTable[seatNum].cabin;
+        const Cabin& cabin = flight.layout->cabins[cabinIndex];
+        return cabin.basePrice * (perCabin ? factor(flight.cabinBooked[cabinIndex], cabin.seatCount)
+                                           : factor(flight.bookedCount, flight.seatCount));
+    }
+    
+    // Current fare of each of the flight's cabins, in layout order
+    void quoteCabins(const Flight& flight, double fares[MAX_CABINS]) const {
+        double flightFactor = factor(flight.bookedCount, flight.seatCount);
+        for(size_t i = 0; i < flight.layout->cabins.size(); i++) {
+            const Cabin& cabin = flight.layout->cabins[i];
+            fares[i] = cabin.basePrice * (perCabin ? factor(flight.cabinBooked[i], cabin.seatCount) : flightFactor);
+        }
+    }
+    
+    // Fares of seats 1..seatCount, entry 0 unused. Each cabin is one run of
+    // seat numbers, so its fare is filled in for the whole run at once.
+    void quoteSeats(const Flight& flight, vector<double>& fares) const {
+        double cabinFares[MAX_CABINS];
+        quoteCabins(flight, cabinFares);
+        fares.assign(flight.seatCount + 1, 0.0);
+        for(size_t i = 0; i < flight.layout->cabins.size(); i++) {
+            const Cabin& cabin = flight.layout->cabins[i];
+            fill_n(fares.begin() + cabin.firstSeat, cabin.seatCount, cabinFares[i]);
+        }
+    }
+};
+
+// Registry of fare curves. Built-in curves are always available and more
+// can be defined in fares.txt, one per line:
+//   ID|scope|LINEAR|slope                     e.g.  SURGE|F|LINEAR|0.8
+//   ID|scope|STEP|occupancy:factor,...        e.g.  PEAK|C|STEP|0:1,0.6:1.25,0.9:1.7
+// Scope F prices by the occupancy of the whole flight, C by that of the
+// seat's cabin. A line USE|ID picks the curve the booking system prices with.
+class FareCurveRegistry {
+private:
+    deque<FareCurve> curves; // deque keeps curve addresses stable as it grows
+    unordered_map<string, const FareCurve*> byId;
+    size_t builtInCount;
+    
+public:
+    FareCurveRegistry() : builtInCount(0) {
+        // Up to 50% more as the flight fills - the original pricing
+        define("DYNAMIC|F|LINEAR|0.5");
+        define("FLAT|F|LINEAR|0");
+        define("STEPPED|F|STEP|0:1,0.5:1.2,0.8:1.5");
+        define("CABIN|C|STEP|0:1,0.5:1.15,0.75:1.35,0.9:1.6");
+        builtInCount = curves.size();
+    }
+    
+    const FareCurve* defaultCurve() const {
+        return find("DYNAMIC");
+    }
+    
+    const FareCurve* find(const string& id) const {
+        auto it = byId.find(id);
+        return (it != byId.end()) ? it->second : nullptr;
+    }
+    
+    const deque<FareCurve>& all() const {
+        return curves;
+    }
+    
+    // Parse and register one curve definition line
+    const FareCurve* define(const string& line) {
+        stringstream ss(line);
+        FareCurve curve;
+        string scopeStr, kindStr, paramStr;
+        getline(ss, curve.id, '|');
+        getline(ss, scopeStr, '|');
+        getline(ss, kindStr, '|');
+        getline(ss, paramStr, '|');
+        transform(kindStr.begin(), kindStr.end(), kindStr.begin(), ::toupper);
+        
+        if(curve.id.empty() || curve.id == "USE" || byId.count(curve.id) || scopeStr.size() != 1) return nullptr;
+        switch(toupper(scopeStr[0])) {
+            case 'F': curve.perCabin = false; break;
+            case 'C': curve.perCabin = true; break;
+            default: return nullptr;
+        }
+        
+        try {
+            if(kindStr == "LINEAR") {
+                curve.slope = stod(paramStr);
+            } else if(kindStr == "STEP") {
+                stringstream stepSS(paramStr);
+                string step;
+                while(getline(stepSS, step, ',')) {
+                    size_t colon = step.find(':');
+                    if(colon == string::npos) return nullptr;
+                    double occupancy = stod(step.substr(0, colon));
+                    double stepFactor = stod(step.substr(colon + 1));
+                    if(occupancy < 0 || stepFactor <= 0 || (!curve.steps.empty() && occupancy <= curve.steps.back().first)) {
+                        return nullptr;
+                    }
+                    curve.steps.emplace_back(occupancy, stepFactor);
+                }
+                if(curve.steps.empty()) return nullptr;
+            } else {
+                return nullptr;
+            }
+        } catch(const exception&) {
+            return nullptr;
+        }
+        
+        curves.push_back(curve);
+        byId[curve.id] = &curves.back();
+        return &curves.back();
+    }
+    
+    static string describe(const FareCurve& curve) {
+        stringstream ss;
+        ss << curve.id << "|" << (curve.perCabin ? 'C' : 'F') << "|";
+        if(curve.steps.empty()) {
+            ss << "LINEAR|" << curve.slope;
+        } else {
+            ss << "STEP|";
+            for(size_t i = 0; i < curve.steps.size(); i++) {
+                ss << (i ? "," : "") << curve.steps[i].first << ":" << curve.steps[i].second;
+            }
+        }
+        return ss.str();
+    }
+    
+    // Write every curve that is not built in and the one in use
+    bool saveFile(const char* path, const FareCurve& active) const {
+        ofstream file(path);
+        if(!file.is_open()) return false;
+        
+        for(size_t i = builtInCount; i < curves.size(); i++) {
+            file << describe(curves[i]) << '\n';
+        }
+        file << "USE|" << active.id << '\n';
+        return true;
+    }
+    
+    // Register the curves in the file; active is left empty when it picks none
+    void loadFile(const char* path, string& active) {
+        ifstream file(path);
+        string line;
+        while(getline(file, line)) {
+            if(!line.empty() && line.back() == '\r') line.pop_back();
+            if(line.empty() || line[0] == '#') continue;
+            if(line.compare(0, 4, "USE|") == 0) {
+                active = line.substr(4);
+            } else if(!find(line.substr(0, line.find('|'))) && !define(line)) {
+                cerr << "Ignoring invalid fare curve: " << line << endl;
+            }
+        }
+    }
+};
+
+FareCurveRegistry& fareCurves() {
+    static FareCurveRegistry registry;
+    return registry;
+}
+
+// One flight's fares at its current occupancy
+struct FlightQuote {
+    const Flight* flight;
+    double cabinFares[MAX_CABINS];   // in layout order
+    int cabinSeatsLeft[MAX_CABINS];
+    double lowestFare;               // cheapest seat still bookable, 0 when none is
+};
+
+// Fare with two decimals, for table columns
+string formatFare(double fare) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.2f", fare);
+    return buffer;
+}
+
+// Whether a seat can be booked, is held for a booking in progress, or is taken
+enum SeatState {
+    SEAT_FREE,
+    SEAT_HELD,
+    SEAT_SOLD
+};
+
+string seatStateName(SeatState state) {
+    switch(state) {
+        case SEAT_FREE: return "AVAILABLE";
+        case SEAT_HELD: return "HELD";
+        default: return "BOOKED";
+    }
+}
+
+// Every seat of one flight with its fare, for seat maps
+struct SeatMapQuote {
+    const SeatLayout* layout;
+    vector<double> fares;     // by seat number, entry 0 unused
+    vector<SeatState> states; // by seat number
+};
+
+// One ticket from a phone number's booking history, with its flight's
+// details copied while the schedule was locked
+struct BookingHistoryEntry {
+    string ticketNumber;
+    string flightNumber;
+    string source;
+    string destination;
+    FlightDate date;
+    FlightStatus status;
+};
+
+// Schedule search. Empty names match any airport and invalid dates or times
+// leave that bound open. A departure window whose earliest time is after its
+// latest wraps past midnight. A negative maxPrice means no limit.
+struct ScheduleQuery {
+    string source;
+    string destination;
+    FlightDate fromDate;
+    FlightDate toDate;
+    FlightTime earliest;
+    FlightTime latest;
+    double maxPrice;
+    
+    ScheduleQuery() : maxPrice(-1) {}
+    
+    bool matchesTime(FlightTime departure) const {
+        if(!earliest.valid() && !latest.valid()) return true;
+        if(!departure.valid()) return false;
+        if(!latest.valid()) return departure.minutes >= earliest.minutes;
+        if(!earliest.valid()) return departure.minutes <= latest.minutes;
+        if(earliest.minutes <= latest.minutes) {
+            return departure.minutes >= earliest.minutes && departure.minutes <= latest.minutes;
+        }
+        return departure.minutes >= earliest.minutes || departure.minutes <= latest.minutes;
+    }
+    
+    bool matchesDate(FlightDate date) const {
+        if(!fromDate.valid() && !toDate.valid()) return true;
+        if(!date.valid()) return false;
+        return (!fromDate.valid() || date.day >= fromDate.day) && (!toDate.valid() || date.day <= toDate.day);
+    }
+};
+
+// How long a passenger needs to change planes at each airport, and the
+// longest layover a connection may include, in minutes. connections.txt
+// holds DEFAULT|<minimum>|<longest layover> and <airport>|<minimum> lines.
+struct ConnectionRules {
+    int defaultMinimum;
+    int maxLayover;
+    map<AirportId, int> minimum; // airports that differ from the default
+    
+    ConnectionRules() : defaultMinimum(45), maxLayover(1440) {}
+    
+    int minimumAt(AirportId airport) const {
+        auto it = minimum.find(airport);
+        return (it != minimum.end()) ? it->second : defaultMinimum;
+    }
+    
+    // Apply one line as in connections.txt; false if it does not parse
+    bool apply(const string& line) {
+        stringstream ss(line);
+        string name, minimumStr, layoverStr;
+        getline(ss, name, '|');
+        getline(ss, minimumStr, '|');
+        getline(ss, layoverStr, '|');
+        
+        int minutes, layover = maxLayover;
+        if(name.empty() || !parseNumber(minimumStr, 0, minimumStr.size(), minutes) ||
+           (!layoverStr.empty() && !parseNumber(layoverStr, 0, layoverStr.size(), layover)) ||
+           minutes > layover) {
+            return false;
+        }
+        
+        if(name == "DEFAULT") {
+            defaultMinimum = minutes;
+            maxLayover = layover;
+        } else {
+            if(!layoverStr.empty()) return false;
+            minimum[airports().intern(name)] = minutes;
+        }
+        return true;
+    }
+    
+    bool saveFile(const char* path) const {
+        ofstream file(path);
+        if(!file.is_open()) return false;
+        
+        file << "DEFAULT|" << defaultMinimum << "|" << maxLayover << '\n';
+        for(const auto& entry : minimum) {
+            file << airports().name(entry.first) << "|" << entry.second << '\n';
+        }
+        return true;
+    }
+    
+    void loadFile(const char* path) {
+        ifstream file(path);
+        string line;
+        while(getline(file, line)) {
+            if(!line.empty() && line.back() == '\r') line.pop_back();
+            if(line.empty() || line[0] == '#') continue;
+            if(!apply(line)) {
+                cerr << "Ignoring invalid connection rule: " << line << endl;
+            }
+        }
+    }
+};
+
+// Flights as time-stamped edges between airports, for connection search.
+// Each airport's departures sit together in departure order, so the onward
+// flights inside a layover window are one binary search away. hops holds,
+// per airport, the airports with a flight into it, for pruning a search to
+// airports that can still reach the destination.
+struct ConnectionGraph {
+    struct Leg {
+        int64_t departs; // minutes since 01/01/1970
+        int64_t arrives;
+        AirportId destination;
+        uint32_t flightPos;
+    };
+    
+    uint64_t version;          // schedule version it was built from
+    vector<uint32_t> firstLeg; // airport -> its first departure in legs, one extra entry at the end
+    vector<Leg> legs;
+    vector<vector<AirportId>> inbound; // airport -> airports with a flight into it
+    
+    ConnectionGraph() : version(UINT64_MAX) {}
+    
+    // Flights without a valid date or times cannot be connected and are left out
+    void build(const vector<Flight>& flights, size_t airportCount, uint64_t scheduleVersion) {
+        firstLeg.assign(airportCount + 1, 0);
+        legs.clear();
+        inbound.assign(airportCount, vector<AirportId>());
+        
+        auto connectable = [](const Flight& flight) {
+            return flight.date.valid() && flight.sourceTime.valid() && flight.destinationTime.valid();
+        };
+        for(const auto& flight : flights) {
+            if(connectable(flight)) firstLeg[flight.source + 1]++;
+        }
+        for(size_t airport = 0; airport < airportCount; airport++) firstLeg[airport + 1] += firstLeg[airport];
+        
+        legs.resize(firstLeg[airportCount]);
+        vector<uint32_t> next(firstLeg.begin(), firstLeg.end() - 1);
+        for(size_t flightPos = 0; flightPos < flights.size(); flightPos++) {
+            const Flight& flight = flights[flightPos];
+            if(!connectable(flight)) continue;
+            legs[next[flight.source]++] = Leg{flight.departureKey(), flight.arrivalKey(), flight.destination,
+                                              static_cast<uint32_t>(flightPos)};
+            inbound[flight.destination].push_back(flight.source);
+        }
+        
+        for(size_t airport = 0; airport < airportCount; airport++) {
+            sort(legs.begin() + firstLeg[airport], legs.begin() + firstLeg[airport + 1], [](const Leg& a, const Leg& b) {
+                return a.departs != b.departs ? a.departs < b.departs : a.flightPos < b.flightPos;
+            });
+            vector<AirportId>& sources = inbound[airport];
+            sort(sources.begin(), sources.end());
+            sources.erase(unique(sources.begin(), sources.end()), sources.end());
+        }
+        version = scheduleVersion;
+    }
+    
+    // Indexes into legs of the departures from the airport in [from, to]
+    pair<uint32_t, uint32_t> departures(AirportId airport, int64_t from, int64_t to) const {
+        auto first = legs.begin() + firstLeg[airport], last = legs.begin() + firstLeg[airport + 1];
+        auto begin = lower_bound(first, last, from, [](const Leg& leg, int64_t time) { return leg.departs < time; });
+        auto end = upper_bound(begin, last, to, [](int64_t time, const Leg& leg) { return time < leg.departs; });
+        return make_pair(static_cast<uint32_t>(begin - legs.begin()), static_cast<uint32_t>(end - legs.begin()));
+    }
+    
+    // Fewest flights from each airport to the destination, ignoring times;
+    // INT_MAX where it cannot be reached within maxLegs
+    vector<int> hopsTo(AirportId destination, int maxLegs) const {
+        vector<int> hops(inbound.size(), INT_MAX);
+        vector<AirportId> frontier(1, destination), reached;
+        hops[destination] = 0;
+        for(int depth = 1; depth <= maxLegs && !frontier.empty(); depth++) {
+            reached.clear();
+            for(AirportId airport : frontier) {
+                for(AirportId source : inbound[airport]) {
+                    if(hops[source] != INT_MAX) continue;
+                    hops[source] = depth;
+                    reached.push_back(source);
+                }
+            }
+            frontier.swap(reached);
+        }
+        return hops;
+    }
+};
+
+enum ItineraryOrder {
+    EARLIEST_ARRIVAL,
+    LOWEST_FARE
+};
+
+// Connection search from one airport to another. The first flight departs
+// between fromDate and toDate (either may be left open); at most maxLegs
+// flights, and the best limit itineraries by the chosen order.
+struct ConnectionQuery {
+    string source;
+    string destination;
+    FlightDate fromDate;
+    FlightDate toDate;
+    ItineraryOrder order;
+    size_t limit;
+    int maxLegs;
+    
+    ConnectionQuery() : order(EARLIEST_ARRIVAL), limit(5), maxLegs(3) {}
+};
+
+// Flights of one journey in travel order, each with its current fares
+struct Itinerary {
+    vector<FlightQuote> legs;
+    double totalFare; // sum of each leg's lowest bookable fare
+    int64_t departs;  // minutes since 01/01/1970
+    int64_t arrives;
+};
+
+// A party booked together on one flight, in one cabin. Leave anyClass set to
+// take the first cabin from economy forward with room for everyone. The
+// members' seats and ticket numbers are filled in by the booking.
+struct GroupBooking {
+    string flightNumber;
+    bool anyClass;
+    SeatClass seatClass;
+    vector<Passenger> party;
+    bool adjacent;    // the party sits in one run of adjacent seats
+    vector<double> fares;
+    double totalFare;
+    
+    GroupBooking() : anyClass(true), seatClass(ECONOMY), adjacent(false), totalFare(0) {}
+};
+
+enum LoyaltyTier {
+    NO_TIER,
+    SILVER_TIER,
+    GOLD_TIER,
+    PLATINUM_TIER
+};
+
+string loyaltyTierName(LoyaltyTier tier) {
+    switch(tier) {
+        case NO_TIER: return "None";
+        case SILVER_TIER: return "Silver";
+        case GOLD_TIER: return "Gold";
+        case PLATINUM_TIER: return "Platinum";
+    }
+    return "Unknown";
+}
+
+// Tier a customer has earned from the bookings they currently hold
+LoyaltyTier loyaltyTierFor(size_t bookings) {
+    if(bookings >= 25) return PLATINUM_TIER;
+    if(bookings >= 10) return GOLD_TIER;
+    if(bookings >= 3) return SILVER_TIER;
+    return NO_TIER;
+}
+
+// A passenger waiting for a seat of one class on a full flight
+struct WaitlistEntry {
+    uint64_t id; // entries are numbered in the order they joined
+    LoyaltyTier tier;
+    SeatClass seatClass;
+    string name;
+    string email;
+    string phone;
+    
+    WaitlistEntry() : id(0), tier(NO_TIER), seatClass(ECONOMY) {}
+};
+
+// One flight's waitlist - a heap per seat class, highest loyalty tier first
+// and then first come, first served. Leaving only forgets the entry; its
+// heap key is thrown away when it reaches the top, so joining, leaving and
+// promoting all stay O(log n) on a list thousands long.
+class Waitlist {
+private:
+    static const int CLASS_COUNT = 4;
+    static const int TIER_COUNT = 4;
+    
+    struct Key {
+        int tier;
+        uint64_t id;
+        
+        // Lower priority - a lower tier, or the same tier but a later request
+        bool operator<(const Key& other) const {
+            return (tier != other.tier) ? tier < other.tier : id > other.id;
+        }
+    };
+    
+    priority_queue<Key> queues[CLASS_COUNT];
+    unordered_map<uint64_t, WaitlistEntry> entries;
+    unordered_set<string> people; // name and phone of everyone waiting
+    size_t waiting[CLASS_COUNT][TIER_COUNT] = {};
+    
+    static string personKey(const string& name, const string& phone) {
+        return name + '\n' + phone;
+    }
+    
+public:
+    size_t size() const {
+        return entries.size();
+    }
+    
+    bool empty() const {
+        return entries.empty();
+    }
+    
+    void add(const WaitlistEntry& entry) {
+        if(!entries.emplace(entry.id, entry).second) return;
+        queues[entry.seatClass].push(Key{entry.tier, entry.id});
+        people.insert(personKey(entry.name, entry.phone));
+        waiting[entry.seatClass][entry.tier]++;
+    }
+    
+    bool remove(uint64_t id) {
+        auto it = entries.find(id);
+        if(it == entries.end()) return false;
+        
+        people.erase(personKey(it->second.name, it->second.phone));
+        waiting[it->second.seatClass][it->second.tier]--;
+        entries.erase(it);
+        return true;
+    }
+    
+    const WaitlistEntry* find(uint64_t id) const {
+        auto it = entries.find(id);
+        return (it != entries.end()) ? &it->second : nullptr;
+    }
+    
+    // First in line for a seat of the class, or nullptr
+    const WaitlistEntry* next(SeatClass seatClass) {
+        priority_queue<Key>& queue = queues[seatClass];
+        while(!queue.empty()) {
+            auto it = entries.find(queue.top().id);
+            if(it != entries.end()) return &it->second;
+            queue.pop();
+        }
+        return nullptr;
+    }
+    
+    bool contains(const string& name, const string& phone) const {
+        return people.count(personKey(name, phone)) > 0;
+    }
+    
+    // Everyone waiting for the class at the tier or above - the place in
+    // line of whoever joined last at that tier
+    size_t lineLength(SeatClass seatClass, LoyaltyTier tier) const {
+        size_t length = 0;
+        for(int t = tier; t < TIER_COUNT; t++) length += waiting[seatClass][t];
+        return length;
+    }
+    
+    // Every entry, by class and then in promotion order
+    vector<WaitlistEntry> ordered() const {
+        vector<WaitlistEntry> result;
+        for(const auto& entry : entries) result.push_back(entry.second);
+        sort(result.begin(), result.end(), [](const WaitlistEntry& a, const WaitlistEntry& b) {
+            if(a.seatClass != b.seatClass) return seatClassRank(a.seatClass) < seatClassRank(b.seatClass);
+            return Key{b.tier, b.id} < Key{a.tier, a.id};
+        });
+        return result;
+    }
+};
+
+// Seats left and the cheapest fare over one route's flights on one day
+struct RouteDay {
+    FlightDate date;
+    int flights;       // flights not canceled
+    int seatsLeft;
+    double lowestFare; // 0 when no seat can be booked
+};
+
+// Availability of one route kept up to date day by day, so a month of it
+// is read without looking at any flight. Each flight's share of its day is
+// stored in slot order. A change to a flight replaces its share and moves
+// the day's totals by the difference; the day's shares are only walked
+// again when the flight that had the lowest fare gets dearer or goes.
+// Only days with flights are kept, keyed by day number, so a stray date
+// years away costs one entry rather than every day in between. lock guards
+// the days and their shares.
+class RouteCalendar {
+private:
+    struct Share {
+        uint32_t slot;
+        int seatsLeft;
+        double lowestFare;
+        bool canceled;
+    };
+    
+    struct Day {
+        RouteDay summary;
+        vector<Share> shares;
+    };
+    
+    map<int32_t, Day> days;
+    
+    static void lowerFare(RouteDay& summary, const Share& share) {
+        if(!share.canceled && share.lowestFare > 0 && (summary.lowestFare == 0 || share.lowestFare < summary.lowestFare)) {
+            summary.lowestFare = share.lowestFare;
+        }
+    }
+    
+    // Take a share out of the day's totals, or put it back in with sign 1
+    static void count(Day& day, const Share& share, int sign) {
+        if(share.canceled) return;
+        day.summary.flights += sign;
+        day.summary.seatsLeft += sign * share.seatsLeft;
+    }
+    
+    static void refreshFare(Day& day) {
+        day.summary.lowestFare = 0;
+        for(const Share& share : day.shares) lowerFare(day.summary, share);
+    }
+    
+    // Whether the share set the day's lowest fare, which must be looked for again without it
+    static bool setsFare(const Day& day, const Share& share) {
+        return !share.canceled && share.lowestFare > 0 && share.lowestFare == day.summary.lowestFare;
+    }
+    
+    Day* find(int32_t day) {
+        auto it = days.find(day);
+        return it == days.end() ? nullptr : &it->second;
+    }
+    
+    static vector<Share>::iterator shareOf(Day& day, uint32_t slot) {
+        return lower_bound(day.shares.begin(), day.shares.end(), slot,
+                           [](const Share& share, uint32_t s) { return share.slot < s; });
+    }
+    
+public:
+    mutex lock;
+    
+    // Add or replace a flight's share of its day
+    void set(FlightDate date, uint32_t slot, int seatsLeft, double lowestFare, bool canceled) {
+        Day& day = days[date.day];
+        Share share = {slot, seatsLeft, lowestFare, canceled};
+        auto it = shareOf(day, slot);
+        bool fareLost = false;
+        if(it != day.shares.end() && it->slot == slot) {
+            count(day, *it, -1);
+            fareLost = setsFare(day, *it) && (canceled || lowestFare == 0 || lowestFare > it->lowestFare);
+            *it = share;
+        } else {
+            day.shares.insert(it, share);
+        }
+        count(day, share, 1);
+        if(fareLost) refreshFare(day);
+        else lowerFare(day.summary, share);
+    }
+    
+    void remove(FlightDate date, uint32_t slot) {
+        Day* day = find(date.day);
+        if(!day) return;
+        auto it = shareOf(*day, slot);
+        if(it == day->shares.end() || it->slot != slot) return;
+        
+        count(*day, *it, -1);
+        bool fareLost = setsFare(*day, *it);
+        day->shares.erase(it);
+        if(day->shares.empty()) days.erase(date.day);
+        else if(fareLost) refreshFare(*day);
+    }
+    
+    // A flight's share as stored, for consistency checks
+    bool share(FlightDate date, uint32_t slot, int& seatsLeft, double& lowestFare) {
+        Day* day = find(date.day);
+        if(!day) return false;
+        auto it = shareOf(*day, slot);
+        if(it == day->shares.end() || it->slot != slot) return false;
+        seatsLeft = it->seatsLeft;
+        lowestFare = it->lowestFare;
+        return true;
+    }
+    
+    // Days whose totals differ from their shares added up afresh
+    size_t staleDays() {
+        size_t stale = 0;
+        for(const auto& entry : days) {
+            const Day& day = entry.second;
+            Day fresh;
+            fresh.summary = RouteDay{FlightDate(), 0, 0, 0};
+            fresh.shares = day.shares;
+            for(const Share& share : fresh.shares) count(fresh, share, 1);
+            refreshFare(fresh);
+            if(fresh.summary.flights != day.summary.flights || fresh.summary.seatsLeft != day.summary.seatsLeft ||
+               fresh.summary.lowestFare != day.summary.lowestFare) {
+                stale++;
+            }
+        }
+        return stale;
+    }
+    
+    // Days from..to inclusive, one entry each - copied straight from the summaries
+    void copyDays(FlightDate from, FlightDate to, vector<RouteDay>& result) {
+        auto it = days.lower_bound(from.day);
+        for(int32_t d = from.day; d <= to.day; d++) {
+            RouteDay summary = RouteDay{FlightDate(), 0, 0, 0};
+            if(it != days.end() && it->first == d) summary = (it++)->second.summary;
+            summary.date = FlightDate(d);
+            result.push_back(summary);
+        }
+    }
+};
+
+// Minutes since 01/01/1970 as DD/MM/YYYY HH:MM
+string formatTimestamp(int64_t minutes) {
+    int64_t day = minutes >= 0 ? minutes / 1440 : (minutes - 1439) / 1440;
+    return FlightDate(static_cast<int32_t>(day)).toString() + " " + FlightTime(static_cast<int>(minutes - day * 1440)).toString();
+}
+
+struct TicketHandle {
+    size_t flight;
+    size_t passenger;
+};
+
+// Hash map split into independently locked shards, so threads working on
+// different keys rarely wait for each other
+template<typename Value, size_t SHARD_BITS = 6>
+class ShardedMap {
+private:
+    static const size_t SHARDS = size_t(1) << SHARD_BITS;
+    
+    struct Shard {
+        mutable mutex lock;
+        unordered_map<string, Value> entries;
+    };
+    
+    unique_ptr<Shard[]> shards;
+    
+public:
+    ShardedMap() : shards(new Shard[SHARDS]) {}
+    
+    // The shard comes from the top bits of a multiplicative hash so keys in
+    // one shard still spread over all buckets of its table
+    size_t shardOf(const string& key) const {
+        uint64_t mixed = static_cast<uint64_t>(hash<string>()(key)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(mixed >> (64 - SHARD_BITS));
+    }
+    
+    bool find(const string& key, Value& value) const {
+        const Shard& shard = shards[shardOf(key)];
+        lock_guard<mutex> guard(shard.lock);
+        auto it = shard.entries.find(key);
+        if(it == shard.entries.end()) return false;
+        value = it->second;
+        return true;
+    }
+    
+    bool contains(const string& key) const {
+        const Shard& shard = shards[shardOf(key)];
+        lock_guard<mutex> guard(shard.lock);
+        return shard.entries.count(key) != 0;
+    }
+    
+    // Run visit on the value for key without copying it out. Returns false
+    // when the key is missing
+    template<typename Visit>
+    bool visit(const string& key, Visit visit) const {
+        const Shard& shard = shards[shardOf(key)];
+        lock_guard<mutex> guard(shard.lock);
+        auto it = shard.entries.find(key);
+        if(it == shard.entries.end()) return false;
+        visit(it->second);
+        return true;
+    }
+    
+    // Returns false, leaving the map unchanged, when the key is already present
+    bool insert(const string& key, const Value& value) {
+        Shard& shard = shards[shardOf(key)];
+        lock_guard<mutex> guard(shard.lock);
+        return shard.entries.emplace(key, value).second;
+    }
+    
+    void set(const string& key, const Value& value) {
+        Shard& shard = shards[shardOf(key)];
+        lock_guard<mutex> guard(shard.lock);
+        shard.entries[key] = value;
+    }
+    
+    void erase(const string& key) {
+        Shard& shard = shards[shardOf(key)];
+        lock_guard<mutex> guard(shard.lock);
+        shard.entries.erase(key);
+    }
+    
+    // Run update on the value for key, creating it if missing, while its shard is locked
+    template<typename Update>
+    void update(const string& key, Update update) {
+        Shard& shard = shards[shardOf(key)];
+        lock_guard<mutex> guard(shard.lock);
+        update(shard.entries[key]);
+    }
+    
+    // Like update(), but leaves missing keys alone and erases the entry when
+    // update returns false
+    template<typename Update>
+    void updateOrErase(const string& key, Update update) {
+        Shard& shard = shards[shardOf(key)];
+        lock_guard<mutex> guard(shard.lock);
+        auto it = shard.entries.find(key);
+        if(it == shard.entries.end()) return;
+        if(!update(it->second)) shard.entries.erase(it);
+    }
+    
+    // Visits every entry, locking one shard at a time
+    template<typename Visit>
+    void forEach(Visit visit) const {
+        for(size_t i = 0; i < SHARDS; i++) {
+            const Shard& shard = shards[i];
+            lock_guard<mutex> guard(shard.lock);
+            for(const auto& entry : shard.entries) {
+                visit(entry.first, entry.second);
+            }
+        }
+    }
+    
+    // Like forEach(), but the values may be modified
+    template<typename Update>
+    void updateEach(Update update) {
+        for(size_t i = 0; i < SHARDS; i++) {
+            Shard& shard = shards[i];
+            lock_guard<mutex> guard(shard.lock);
+            for(auto& entry : shard.entries) {
+                update(entry.first, entry.second);
+            }
+        }
+    }
+    
+    size_t size() const {
+        size_t total = 0;
+        for(size_t i = 0; i < SHARDS; i++) {
+            lock_guard<mutex> guard(shards[i].lock);
+            total += shards[i].entries.size();
+        }
+        return total;
+    }
+    
+    void reserve(size_t count) {
+        for(size_t i = 0; i < SHARDS; i++) {
+            lock_guard<mutex> guard(shards[i].lock);
+            shards[i].entries.reserve(count / SHARDS + 1);
+        }
+    }
+    
+    void clear() {
+        for(size_t i = 0; i < SHARDS; i++) {
+            lock_guard<mutex> guard(shards[i].lock);
+            shards[i].entries.clear();
+        }
+    }
+};
+
+typedef ShardedMap<TicketHandle> TicketIndex;
+
+// Fixed-size records of a flight blob in the store. Strings are offsets into
+// the blob's string pool, each prefixed by its uint32 length.
+struct FlightRecord {
+    uint32_t flightNumber;
+    uint32_t source;
+    uint32_t destination;
+    uint32_t sourceTime;
+    uint32_t destinationTime;
+    uint32_t date;
+    uint32_t via;
+    int32_t stops;
+    double basePrice;
+    int32_t status;
+    uint32_t layout;
+    uint32_t slot;
+    uint64_t passengerCount;
+    uint64_t bookedSeats[SEAT_WORDS];
+};
+
+struct PassengerRecord {
+    uint32_t name;
+    uint32_t email;
+    uint32_t phone;
+    uint32_t ticketNumber;
+    int32_t seatNumber;
+};
+
+// Builds the string pool while a blob is being encoded
+struct StringPoolWriter {
+    string data;
+    
+    uint32_t add(string_view str) {
+        uint32_t offset = static_cast<uint32_t>(data.size());
+        uint32_t length = static_cast<uint32_t>(str.size());
+        data.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        data.append(str);
+        return offset;
+    }
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    const char* data;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    
+public:
+#ifdef _WIN32
+    MappedFile() : data(nullptr), length(0), file(INVALID_HANDLE_VALUE), mapping(nullptr) {}
+#else
+    MappedFile() : data(nullptr), length(0), fd(-1) {}
+#endif
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    ~MappedFile() {
+        close();
+    }
+    
+    bool open(const char* path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return false;
+        
+        LARGE_INTEGER fileSize;
+        if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        length = static_cast<size_t>(fileSize.QuadPart);
+        
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mapping) {
+            close();
+            return false;
+        }
+        data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        fd = ::open(path, O_RDONLY);
+        if(fd < 0) return false;
+        
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0) {
+            close();
+            return false;
+        }
+        length = static_cast<size_t>(st.st_size);
+        
+        void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = (mapped == MAP_FAILED) ? nullptr : static_cast<const char*>(mapped);
+#endif
+        if(!data) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    void close() {
+#ifdef _WIN32
+        if(data) UnmapViewOfFile(data);
+        if(mapping) CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(data) munmap(const_cast<char*>(data), length);
+        if(fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        length = 0;
+    }
+    
+    const char* begin() const { return data; }
+    size_t size() const { return length; }
+};
+
+// Incremental store layout - the binary snapshot of flights, seats and
+// passengers, versioned through STORE_VERSION and read in place through
+// MappedFile. flights.idx holds a StoreHeader and one StoreEntry per flight slot. Each entry points at a self-contained blob in the data file:
+//   flight  - FlightRecord, its PassengerRecords, then its string pool
+//   airports - uint32 count, uint32 name offsets, string pool
+// A checkpoint appends blobs only for what changed and swaps in a new index
+// pointing at them; once the data file is mostly dead blobs it is rewritten as a
+// new generation.
+const char STORE_MAGIC[8] = {'H', 'J', 'D', 'T', 'S', 'T', 'O', 'R'};
+const uint32_t STORE_VERSION = 1;
+
+struct StoreEntry {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t used;
+};
+
+struct StoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t generation;
+    uint64_t dataSize;      // committed length of the data file
+    uint64_t liveBytes;     // bytes of the data file still referenced
+    uint64_t ticketSequence;
+    uint64_t flightSlotSequence;
+    uint64_t flightSlotCount;
+    StoreEntry airports;
+};
+
+string storeDataFile(uint32_t generation) {
+    return "flights." + to_string(generation) + ".dat";
+}
+
+// Replace a small text file with text
+bool writeTextFile(const char* path, const string& text) {
+    ofstream file(path);
+    if(!file.is_open()) return false;
+    file << text;
+    return static_cast<bool>(file);
+}
+
+// Push a file's buffered writes through to the disk
+bool syncFile(FILE* file) {
+    if(fflush(file) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// 64-bit safe seek and tell
+bool seekFile(FILE* file, uint64_t offset, int origin) {
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<int64_t>(offset), origin) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), origin) == 0;
+#endif
+}
+
+uint64_t tellFile(FILE* file) {
+#ifdef _WIN32
+    return static_cast<uint64_t>(_ftelli64(file));
+#else
+    return static_cast<uint64_t>(ftello(file));
+#endif
+}
+
+// Bounds-checked reads from a blob
+struct BlobReader {
+    const char* data;
+    size_t length;
+    
+    bool fits(uint64_t offset, uint64_t count, size_t recordSize) const {
+        return offset <= length && count <= (length - offset) / recordSize;
+    }
+    
+    template<typename Record>
+    bool read(uint64_t offset, Record& record) const {
+        if(!fits(offset, 1, sizeof(Record))) return false;
+        memcpy(&record, data + offset, sizeof(Record));
+        return true;
+    }
+    
+    // Length-prefixed string at offset into the pool starting at poolOffset
+    bool view(uint64_t poolOffset, uint32_t offset, string_view& value) const {
+        uint32_t size;
+        if(!read(poolOffset + offset, size) || !fits(poolOffset + offset + sizeof(size), size, 1)) return false;
+        value = string_view(data + poolOffset + offset + sizeof(size), size);
+        return true;
+    }
+    
+    bool str(uint64_t poolOffset, uint32_t offset, string& value) const {
+        string_view found;
+        if(!view(poolOffset, offset, found)) return false;
+        value.assign(found.data(), found.size());
+        return true;
+    }
+};
+
+// Bytes the persistence layer has written, for measuring save cost
+struct PersistenceStats {
+    uint64_t mutations;       // journal records appended
+    uint64_t journalBytes;
+    uint64_t journalSyncs;    // group commits - one write and one fsync each
+    uint64_t checkpoints;
+    uint64_t checkpointBytes; // data and index bytes written by checkpoints
+};
+
+struct TicketIndexRecord {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t numberLength;
+    char number[48];
+};
+
+// Append-only archive of rendered tickets. The index is read into a hash
+// map when the archive is first used, so finding a ticket is one lookup and
+// reading it one seek and one read. Text is written before its index record,
+// and index records past the end of the text are ignored, so a crash at
+// worst loses the last ticket - which can be rendered again from its booking.
+class TicketArchive {
+private:
+    struct Location {
+        uint64_t offset;
+        uint32_t length;
+    };
+    
+    mutex lock;
+    FILE* data;
+    FILE* index;
+    uint64_t dataSize;
+    uint64_t indexCount;
+    unordered_map<string, Location> locations;
+    
+    // Open both files for reading and writing, creating them if needed
+    static FILE* openFile(const char* path) {
+        FILE* file = fopen(path, "r+b");
+        if(!file) file = fopen(path, "w+b");
+        return file;
+    }
+    
+    bool open() {
+        if(data && index) return true;
+        data = openFile(TICKET_ARCHIVE_FILE);
+        index = openFile(TICKET_INDEX_FILE);
+        if(!data || !index || !seekFile(data, 0, SEEK_END)) {
+            close();
+            return false;
+        }
+        dataSize = tellFile(data);
+        
+        // A later record for the same ticket replaces the earlier one
+        TicketIndexRecord record;
+        indexCount = 0;
+        rewind(index);
+        while(fread(&record, sizeof(record), 1, index) == 1) {
+            if(record.numberLength > sizeof(record.number) || record.offset > dataSize ||
+               record.length > dataSize - record.offset) break;
+            locations[string(record.number, record.numberLength)] = Location{record.offset, record.length};
+            indexCount++;
+        }
+        return true;
+    }
+    
+    void close() {
+        if(data) fclose(data);
+        if(index) fclose(index);
+        data = nullptr;
+        index = nullptr;
+        locations.clear();
+    }
+    
+public:
+    TicketArchive() : data(nullptr), index(nullptr), dataSize(0), indexCount(0) {}
+    
+    TicketArchive(const TicketArchive&) = delete;
+    TicketArchive& operator=(const TicketArchive&) = delete;
+    
+    ~TicketArchive() {
+        close();
+    }
+    
+    bool append(const string& ticketNumber, const string& text) {
+        lock_guard<mutex> guard(lock);
+        if(ticketNumber.size() > sizeof(TicketIndexRecord::number) || !open()) return false;
+        
+        TicketIndexRecord record = {};
+        record.offset = dataSize;
+        record.length = static_cast<uint32_t>(text.size());
+        record.numberLength = static_cast<uint32_t>(ticketNumber.size());
+        memcpy(record.number, ticketNumber.data(), ticketNumber.size());
+        
+        if(!seekFile(data, dataSize, SEEK_SET) || fwrite(text.data(), 1, text.size(), data) != text.size() ||
+           fflush(data) != 0) return false;
+        dataSize += text.size();
+        
+        if(!seekFile(index, indexCount * sizeof(record), SEEK_SET) || fwrite(&record, sizeof(record), 1, index) != 1 ||
+           fflush(index) != 0) return false;
+        indexCount++;
+        
+        locations[ticketNumber] = Location{record.offset, record.length};
+        return true;
+    }
+    
+    bool read(const string& ticketNumber, string& text) {
+        lock_guard<mutex> guard(lock);
+        if(!open()) return false;
+        
+        auto it = locations.find(ticketNumber);
+        if(it == locations.end()) return false;
+        
+        text.resize(it->second.length);
+        return seekFile(data, it->second.offset, SEEK_SET) &&
+               fread(&text[0], 1, text.size(), data) == text.size();
+    }
+};
+
+// Hierarchical timing wheel. Level n has SLOTS slots of SLOTS^n ticks each;
+// a timer sits in the lowest level whose span reaches its deadline, and is
+// moved down a level each time the tick reaches its slot there, firing from
+// level 0. Timers are list nodes in a slab, addressed by index, so
+// scheduling and cancelling are O(1) and a timer is touched at most LEVELS
+// times however many are outstanding. A timer ID carries the slot's
+// generation, so the ID of a timer that fired or was cancelled never
+// matches a later one. Deadlines past the top level's span are clamped to
+// it and rescheduled when they come down.
+class TimingWheel {
+private:
+    static const int SLOT_BITS = 6;
+    static const uint32_t SLOTS = 1u << SLOT_BITS;
+    static const int LEVELS = 4;
+    static const uint32_t NONE = UINT32_MAX;
+    
+    struct Node {
+        uint64_t deadline;
+        uint64_t payload;
+        uint32_t prev;
+        uint32_t next;       // free list link while the node is unused
+        uint32_t generation;
+        uint32_t bucket;     // level * SLOTS + slot, NONE while unused
+    };
+    
+    vector<Node> nodes;
+    uint32_t freeList;
+    uint32_t heads[LEVELS * SLOTS];
+    uint64_t currentTick;
+    size_t count;
+    
+    void link(uint32_t index) {
+        Node& node = nodes[index];
+        uint64_t deadline = max(node.deadline, currentTick);
+        uint64_t delta = deadline - currentTick;
+        int level = 0;
+        while(level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) level++;
+        if(level == LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * LEVELS))) {
+            deadline = currentTick + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+        }
+        
+        node.bucket = level * SLOTS + ((deadline >> (SLOT_BITS * level)) & (SLOTS - 1));
+        node.prev = NONE;
+        node.next = heads[node.bucket];
+        if(node.next != NONE) nodes[node.next].prev = index;
+        heads[node.bucket] = index;
+    }
+    
+    void unlink(uint32_t index) {
+        Node& node = nodes[index];
+        if(node.prev != NONE) nodes[node.prev].next = node.next;
+        else heads[node.bucket] = node.next;
+        if(node.next != NONE) nodes[node.next].prev = node.prev;
+    }
+    
+    void release(uint32_t index) {
+        Node& node = nodes[index];
+        node.bucket = NONE;
+        node.generation++;
+        node.next = freeList;
+        freeList = index;
+        count--;
+    }
+    
+    uint32_t indexOf(uint64_t id) const {
+        uint32_t index = static_cast<uint32_t>(id);
+        if(index >= nodes.size() || nodes[index].bucket == NONE ||
+           nodes[index].generation != static_cast<uint32_t>(id >> 32)) {
+            return NONE;
+        }
+        return index;
+    }
+    
+public:
+    explicit TimingWheel(uint64_t startTick = 0) : freeList(NONE), currentTick(startTick), count(0) {
+        fill(begin(heads), end(heads), NONE);
+    }
+    
+    size_t size() const {
+        return count;
+    }
+    
+    uint64_t now() const {
+        return currentTick;
+    }
+    
+    // Returns the timer's ID, never 0. A deadline already passed fires on the next advance.
+    uint64_t schedule(uint64_t deadline, uint64_t payload) {
+        uint32_t index;
+        if(freeList != NONE) {
+            index = freeList;
+            freeList = nodes[index].next;
+        } else {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(Node{0, 0, NONE, NONE, 1, NONE});
+        }
+        nodes[index].deadline = max(deadline, currentTick + 1);
+        nodes[index].payload = payload;
+        link(index);
+        count++;
+        return (static_cast<uint64_t>(nodes[index].generation) << 32) | index;
+    }
+    
+    // Payload and deadline of a pending timer; false once it fired or was cancelled
+    bool find(uint64_t id, uint64_t& payload, uint64_t& deadline) const {
+        uint32_t index = indexOf(id);
+        if(index == NONE) return false;
+        payload = nodes[index].payload;
+        deadline = nodes[index].deadline;
+        return true;
+    }
+    
+    bool cancel(uint64_t id) {
+        uint32_t index = indexOf(id);
+        if(index == NONE) return false;
+        unlink(index);
+        release(index);
+        return true;
+    }
+    
+    // Run the wheel forward to tick, calling fired(id, payload) for every
+    // timer whose deadline is reached. With nothing pending it jumps straight there.
+    template<typename Callback>
+    void advance(uint64_t tick, Callback fired) {
+        while(currentTick < tick) {
+            if(count == 0) {
+                currentTick = tick;
+                return;
+            }
+            currentTick++;
+            
+            // Bring down the higher-level slots this tick starts, top level first
+            int level = 1;
+            while(level < LEVELS && (currentTick & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) == 0) level++;
+            for(level--; level >= 1; level--) {
+                uint32_t& head = heads[level * SLOTS + ((currentTick >> (SLOT_BITS * level)) & (SLOTS - 1))];
+                uint32_t index = head;
+                head = NONE;
+                while(index != NONE) {
+                    uint32_t next = nodes[index].next;
+                    link(index);
+                    index = next;
+                }
+            }
+            
+            uint32_t& head = heads[currentTick & (SLOTS - 1)];
+            while(head != NONE) {
+                uint32_t index = head;
+                head = nodes[index].next;
+                if(head != NONE) nodes[head].prev = NONE;
+                
+                uint64_t id = (static_cast<uint64_t>(nodes[index].generation) << 32) | index;
+                uint64_t payload = nodes[index].payload;
+                release(index);
+                fired(id, payload);
+            }
+        }
+    }
+};
+
+// Output collected in a large buffer and handed to the stream in big
+// chunks, so a listing of millions of rows costs a few large writes rather
+// than a formatted stream insertion per field. Numbers are formatted with
+// to_chars; doubles as ostream prints them by default (%g).
+class OutputBuffer {
+private:
+    static const size_t CHUNK_SIZE = 1 << 20;
+    
+    ostream& out;
+    unique_ptr<char[]> buffer;
+    size_t used;
+    
+    template<typename Number>
+    OutputBuffer& number(Number value) {
+        char digits[24];
+        to_chars_result result = to_chars(digits, digits + sizeof(digits), value);
+        return *this << string_view(digits, result.ptr - digits);
+    }
+    
+    void appendSlow(string_view text) {
+        flush();
+        if(text.size() > CHUNK_SIZE) {
+            out.write(text.data(), text.size());
+        } else {
+            memcpy(buffer.get(), text.data(), text.size());
+            used = text.size();
+        }
+    }
+    
+public:
+    explicit OutputBuffer(ostream& out) : out(out), buffer(new char[CHUNK_SIZE]), used(0) {}
+    
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+    
+    ~OutputBuffer() {
+        flush();
+    }
+    
+    OutputBuffer& operator<<(string_view text) {
+        if(used + text.size() <= CHUNK_SIZE) {
+            memcpy(buffer.get() + used, text.data(), text.size());
+            used += text.size();
+        } else {
+            appendSlow(text);
+        }
+        return *this;
+    }
+    
+    OutputBuffer& operator<<(const char* text) { return *this << string_view(text); }
+    OutputBuffer& operator<<(const string& text) { return *this << string_view(text); }
+    OutputBuffer& operator<<(char c) {
+        if(used == CHUNK_SIZE) flush();
+        buffer[used++] = c;
+        return *this;
+    }
+
+    OutputBuffer& operator<<(int value) { return number(value); }
+    OutputBuffer& operator<<(long long value) { return number(value); }
+    OutputBuffer& operator<<(unsigned long long value) { return number(value); }
+    OutputBuffer& operator<<(unsigned long value) { return number(value); }
+    
+    OutputBuffer& operator<<(double value) {
+        char digits[32];
+        to_chars_result result = to_chars(digits, digits + sizeof(digits), value, chars_format::general, 6);
+        return *this << string_view(digits, result.ptr - digits);
+    }
+    
+    // Hand what is buffered to the stream; false once the stream has failed
+    bool flush() {
+        if(used) {
+            out.write(buffer.get(), used);
+            used = 0;
+        }
+        return static_cast<bool>(out);
+    }
+};
+
+enum ReportFormat {
+    TABLE_REPORT,
+    CSV_REPORT,
+    JSON_REPORT
+};
+
+bool parseReportFormat(string name, ReportFormat& format) {
+    transform(name.begin(), name.end(), name.begin(), ::tolower);
+    if(name == "table") format = TABLE_REPORT;
+    else if(name == "csv") format = CSV_REPORT;
+    else if(name == "json") format = JSON_REPORT;
+    else return false;
+    return true;
+}
+
+// Column of a report - its table heading and width, and its CSV and JSON name
+struct ReportColumn {
+    const char* title;
+    const char* key;
+    int width;
+};
+
+// Streams the rows of a listing as a padded table, CSV (RFC 4180 quoting)
+// or a JSON array of objects. Rows are formatted straight into an
+// OutputBuffer; the header is written up front and the JSON array closed by
+// finish(). Fields are given in column order, one call each.
+class ReportWriter {
+private:
+    enum { CSV_SPECIAL = 1, JSON_SPECIAL = 2 };
+    
+    OutputBuffer out;
+    ReportFormat format;
+    vector<ReportColumn> columns;
+    vector<string> jsonKeys; // each column's "key": with the comma that leads it
+    size_t column; // next field of the current row
+    size_t rows;
+    
+    // Which characters make a field need CSV quoting or a JSON escape
+    static const uint8_t* specialCharacters() {
+        static const vector<uint8_t> table = [] {
+            vector<uint8_t> special(256, 0);
+            for(unsigned char c : string(",\"\r\n")) special[c] |= CSV_SPECIAL;
+            for(int c = 0; c < 0x20; c++) special[c] |= JSON_SPECIAL;
+            special['"'] |= JSON_SPECIAL;
+            special['\\'] |= JSON_SPECIAL;
+            return special;
+        }();
+        return table.data();
+    }
+    
+    static size_t findSpecial(string_view value, uint8_t kind) {
+        const uint8_t* special = specialCharacters();
+        for(size_t i = 0; i < value.size(); i++) {
+            if(special[static_cast<unsigned char>(value[i])] & kind) return i;
+        }
+        return string_view::npos;
+    }
+    
+    // Padded to the column width like setw, but an overlong value still gets
+    // one space before the next column; the last column is not padded
+    void tableField(string_view value) {
+        static const string_view spaces = "                                                                ";
+        out << value;
+        if(column + 1 == columns.size()) return;
+        int pad = max(1, columns[column].width - static_cast<int>(value.size()));
+        out << spaces.substr(0, pad);
+    }
+    
+    void csvField(string_view value) {
+        if(column) out << ',';
+        if(findSpecial(value, CSV_SPECIAL) == string_view::npos) {
+            out << value;
+            return;
+        }
+        
+        out << '"';
+        for(size_t quote; (quote = value.find('"')) != string_view::npos; value.remove_prefix(quote + 1)) {
+            out << value.substr(0, quote + 1) << '"';
+        }
+        out << value << '"';
+    }
+    
+    void jsonString(string_view value) {
+        out << '"';
+        for(size_t i; (i = findSpecial(value, JSON_SPECIAL)) != string_view::npos; value.remove_prefix(i + 1)) {
+            unsigned char c = value[i];
+            out << value.substr(0, i);
+            switch(c) {
+                case '"': out << "\\\""; break;
+                case '\\': out << "\\\\"; break;
+                case '\n': out << "\\n"; break;
+                case '\r': out << "\\r"; break;
+                case '\t': out << "\\t"; break;
+                default: {
+                    char escape[8];
+                    snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    out << escape;
+                }
+            }
+        }
+        out << value << '"';
+    }
+    
+    void put(string_view value, bool isNumber) {
+        switch(format) {
+            case TABLE_REPORT: tableField(value); break;
+            case CSV_REPORT: csvField(value); break;
+            case JSON_REPORT:
+                if(!column) out << (rows ? ",\n{" : "{");
+                out << jsonKeys[column];
+                if(isNumber) out << value;
+                else jsonString(value);
+                break;
+        }
+        column++;
+    }
+    
+public:
+    ReportWriter(ostream& stream, ReportFormat format, const vector<ReportColumn>& columns) :
+        out(stream), format(format), columns(columns), column(0), rows(0) {
+        if(format == JSON_REPORT) {
+            for(const auto& col : columns) {
+                jsonKeys.push_back(jsonKeys.empty() ? "\"" : ",\"");
+                jsonKeys.back() += col.key;
+                jsonKeys.back() += "\":";
+            }
+            out << "[\n";
+        } else if(format == CSV_REPORT) {
+            for(column = 0; column < columns.size(); column++) csvField(columns[column].key);
+            out << '\n';
+        } else {
+            int lineWidth = 0;
+            for(column = 0; column < columns.size(); column++) {
+                tableField(columns[column].title);
+                lineWidth += columns[column].width;
+            }
+            out << '\n' << string(lineWidth, '-') << '\n';
+        }
+        column = 0;
+    }
+    
+    ReportWriter& field(string_view value) {
+        put(value, false);
+        return *this;
+    }
+    
+    ReportWriter& field(long long value) {
+        char digits[24];
+        to_chars_result result = to_chars(digits, digits + sizeof(digits), value);
+        put(string_view(digits, result.ptr - digits), true);
+        return *this;
+    }
+    
+    ReportWriter& field(double value, int precision) {
+        char digits[64];
+        to_chars_result result = to_chars(digits, digits + sizeof(digits), value, chars_format::fixed, precision);
+        put(result.ec == errc() ? string_view(digits, result.ptr - digits) : string_view("0"), true);
+        return *this;
+    }
+    
+    void endRow() {
+        out << (format == JSON_REPORT ? "}" : "\n");
+        column = 0;
+        rows++;
+    }
+    
+    // Close the report and flush it. Returns false if the stream failed.
+    bool finish() {
+        if(format == JSON_REPORT) out << (rows ? "\n]\n" : "]\n");
+        return out.flush();
+    }
+    
+    size_t rowCount() const {
+        return rows;
+    }
+};
+
+// Flight Booking System Class
+class FlightBookingSystem {
+private:
+    vector<Flight> flights;
+    PassengerStore passengerStore;
+    ShardedMap<vector<PassengerId>> customerIndex; // phone -> that customer's bookings, oldest ticket first
+    unordered_map<string, size_t> flightIndex; // flightNumber -> position in flights
+    TicketIndex ticketIndex;                   // ticketNumber -> flight and passenger
+    unordered_map<uint64_t, vector<size_t>> routeIndex; // source and destination IDs -> positions in flights
+    unordered_map<uint64_t, unique_ptr<RouteCalendar>> routeCalendars; // same keys, added to only under the exclusive lock
+    set<pair<int64_t, size_t>> departureIndex;          // (departure key, position) in chronological order
+    
+    // Locking: anything that adds, removes or edits flights holds scheduleMutex
+    // exclusively. Bookings, cancellations and searches hold it shared and then
+    // lock only the flight they touch, so different flights book in parallel.
+    struct alignas(64) FlightLock {
+        mutex lock;
+    };
+    static const size_t FLIGHT_LOCK_STRIPES = 1024;
+    
+    mutable shared_mutex scheduleMutex;
+    FlightLock flightLocks[FLIGHT_LOCK_STRIPES];
+    
+    // slot -> position in flights, NO_FLIGHT for slots of deleted flights
+    static constexpr size_t NO_FLIGHT = SIZE_MAX;
+    vector<size_t> slotIndex;
+    uint32_t nextFlightSlot;
+    
+    // The curve every seat is priced with - only replaced under the exclusive schedule lock
+    const FareCurve* fareCurve;
+    
+    // Connection search. scheduleVersion moves whenever a flight is added,
+    // removed, moved or rescheduled, under the exclusive schedule lock; the
+    // graph is rebuilt from the flights on the first search after that.
+    ConnectionRules connectionRules;
+    uint64_t scheduleVersion;
+    ConnectionGraph routeGraph;
+    mutex routeGraphMutex;
+    
+    // Seat holds. Each hold sets its seat's held bit on the flight and is a
+    // timer on holdWheel, whose ID is the hold's token and whose payload is
+    // the flight slot and seat. holdMutex guards the wheel and is taken after
+    // a flight lock, never before. The reaper thread is started by the first
+    // hold and expires holds as their ticks pass. The interactive menus read
+    // flights without locks, so under them holdsExpireInline keeps the reaper
+    // from starting and the menu thread expires holds between screens.
+    static const int HOLD_TICK_MS = 100;
+    TimingWheel holdWheel;
+    mutex holdMutex;
+    condition_variable holdWork;
+    chrono::steady_clock::time_point holdEpoch;
+    bool holdStopping;
+    bool holdsExpireInline;
+    thread holdReaper;
+    
+    // Waitlists by flight slot, each guarded by its flight's lock. The vector
+    // only grows under the exclusive schedule lock, as flights are indexed.
+    vector<unique_ptr<Waitlist>> waitlists;
+    atomic<uint64_t> nextWaitlistId;
+    atomic<bool> waitlistsDirty;
+    
+    // Ticket sequences are handed out from nextTicketSequence. Everything below
+    // reservedTicketSequence has been reserved in the journal or snapshot.
+    static constexpr uint64_t TICKET_BLOCK_SIZE = 4096;
+    atomic<uint64_t> nextTicketSequence;
+    atomic<uint64_t> reservedTicketSequence;
+    mutex ticketBlockMutex;
+    
+    // Incremental store state - where each flight slot's current blob lives,
+    // and what has changed since it was written. A save gathers its blobs
+    // under the exclusive schedule lock and writes them after releasing it;
+    // storeMutex keeps one save at a time and guards the generation.
+    mutex storeMutex;
+    uint32_t storeGeneration; // 0 until the store has been written
+    uint64_t storeDataSize;
+    uint64_t storeLiveBytes;
+    StoreEntry airportEntry;
+    size_t storedAirportCount;
+    vector<StoreEntry> flightEntries;  // by flight slot
+    vector<uint32_t> deletedSlots;     // flights deleted since the last save
+    atomic<bool> storeRewriteDue;
+    atomic<bool> storeUnreadable; // nothing is saved until --import-text replaces the state
+    PersistenceStats persistenceStats;
+    
+    // Everything one save writes, encoded while the schedule is locked
+    struct PendingSave {
+        bool rewrite;               // a new generation rather than an append
+        uint64_t dataOffset;        // where data goes in the current generation
+        string data;                // the blobs, back to back
+        StoreHeader header;
+        vector<StoreEntry> entries;
+        string layouts;             // empty when there are no custom layouts
+        bool hasWaitlists;
+        string waitlists;
+    };
+    
+    // Journal records are queued for the persistence worker, which writes
+    // everything queued since its last pass with one write and one fsync and
+    // runs the checkpoints. Records are numbered in queue order; all below
+    // durableSequence have been written. journalMutex guards all of this.
+    TicketArchive ticketArchive;
+    
+    bool persistent;
+    mutex journalMutex;
+    condition_variable journalWork;    // records queued, checkpoint requested or stopping
+    condition_variable journalSynced;  // durableSequence or checkpointsDone moved
+    string pendingRecords;
+    size_t pendingCount;
+    uint64_t nextJournalSequence;
+    uint64_t durableSequence;
+    bool journalFailed;                // a write failed since the last checkpoint
+    bool checkpointRequested;
+    uint64_t checkpointsDone;
+    bool stopping;
+    FILE* journalFile;                 // only touched by the worker
+    int journalRecords;
+    thread persistenceThread;
+    atomic<DurabilityPolicy> durabilityPolicy;
+    
+    // The last record queued by this thread, so an operation can wait for
+    // its own record without threading the sequence through every call
+    struct QueuedRecord {
+        const FlightBookingSystem* system;
+        uint64_t sequence;
+    };
+    static inline thread_local QueuedRecord lastJournalRecord = {nullptr, 0};
+    
+    mutex& flightLock(size_t flightPos) {
+        return flightLocks[flightPos % FLIGHT_LOCK_STRIPES].lock;
+    }
+    
+    // Flight header line shared by flights.txt and the journal
+    static string formatFlightHeader(const Flight& flight) {
+        stringstream ss;
+        ss << flight.flightNumber << "|"
+           << flight.sourceName() << "|"
+           << flight.destinationName() << "|"
+           << flight.sourceTime << "|"
+           << flight.destinationTime << "|"
+           << flight.date << "|"
+           << flight.basePrice << "|"
+           << flight.viaName() << "|"
+           << flight.stops << "|"
+           << static_cast<int>(flight.status) << "|"
+           << flight.layout->id << "|"
+           << flight.slot;
+        return ss.str();
+    }
+    
+    // Returns false when the line names no known seat layout (files written
+    // before layouts existed); the flight then keeps the default layout.
+    // Throws on a malformed number, an unknown status or negative stops.
+    static bool parseFlightHeader(stringstream& ss, Flight& flight) {
+        string source, destination, via, sourceTime, destinationTime, date;
+        getline(ss, flight.flightNumber, '|');
+        getline(ss, source, '|');
+        getline(ss, destination, '|');
+        getline(ss, sourceTime, '|');
+        getline(ss, destinationTime, '|');
+        getline(ss, date, '|');
+        
+        string priceStr, stopsStr, statusStr;
+        getline(ss, priceStr, '|');
+        getline(ss, via, '|');
+        getline(ss, stopsStr, '|');
+        getline(ss, statusStr, '|');
+        
+        flight.source = airports().intern(source);
+        flight.destination = airports().intern(destination);
+        flight.via = airports().intern(via);
+        flight.sourceTime = FlightTime();
+        flight.destinationTime = FlightTime();
+        flight.date = FlightDate();
+        FlightTime::parse(sourceTime, flight.sourceTime);
+        FlightTime::parse(destinationTime, flight.destinationTime);
+        FlightDate::parse(date, flight.date);
+        flight.basePrice = stod(priceStr);
+        flight.stops = stoi(stopsStr);
+        flight.status = flightStatusFromNumber(stoi(statusStr));
+        if(flight.stops < 0) throw invalid_argument("stops");
+        
+        string layoutId, slotStr;
+        getline(ss, layoutId, '|');
+        getline(ss, slotStr, '|');
+        flight.slot = slotStr.empty() ? 0 : static_cast<uint32_t>(stoul(slotStr));
+        
+        const SeatLayout* layout = seatLayouts().find(layoutId);
+        if(!layout) return false;
+        
+        flight.setLayout(layout);
+        return true;
+    }
+    
+    bool saveTextSnapshot() {
+        ofstream flightFile("flights.txt");
+        if(!flightFile.is_open()) {
+            cerr << "Error saving flight data!" << endl;
+            return false;
+        }
+        
+        {
+            OutputBuffer out(flightFile);
+            for(const auto& flight : flights) {
+                writeFlightText(out, flight, passengerStore);
+            }
+        }
+        
+        flightFile.close();
+        
+        // Booking history is derived from the passengers and never read back,
+        // but is still exported for anyone reading the text files
+        ofstream historyFile("bookingHistory.txt");
+        if(!historyFile.is_open()) {
+            cerr << "Error saving booking history!" << endl;
+            return false;
+        }
+        
+        // Sorted by phone so exports are stable from run to run
+        vector<pair<string, vector<string>>> history;
+        customerIndex.forEach([&](const string& phone, const vector<PassengerId>& bookings) {
+            vector<string> tickets;
+            for(PassengerId id : bookings) tickets.emplace_back(passengerStore.ticketNumber(id));
+            history.emplace_back(phone, move(tickets));
+        });
+        sort(history.begin(), history.end());
+        
+        {
+            OutputBuffer out(historyFile);
+            for(const auto& entry : history) {
+                writeHistoryText(out, entry.first, entry.second);
+            }
+        }
+        
+        historyFile.close();
+        return true;
+    }
+    
+    // flights.txt is only written by --export-text and the generator; it seeds
+    // a tree with no store yet and is read back by --import-text
+    void loadTextSnapshot() {
+        ifstream flightFile("flights.txt");
+        if(!flightFile.is_open()) {
+            cerr << "No saved flight data found. Starting fresh." << endl;
+            return;
+        }
+        
+        clearFlights();
+        string line, seatLine, passengerLine;
+        
+        while(getline(flightFile, line)) {
+            if(line.empty()) continue;
+            
+            // All three lines of a flight are read first, so a malformed one
+            // skips just that flight and the next starts on its header
+            seatLine.clear();
+            passengerLine.clear();
+            if(getline(flightFile, seatLine)) getline(flightFile, passengerLine);
+            
+            try {
+                loadTextFlight(line, seatLine, passengerLine);
+            } catch(const exception&) {
+                cerr << "Skipping invalid flight in flights.txt: " << line << endl;
+            }
+        }
+        
+        flightFile.close();
+    }
+    
+    // One flight of flights.txt - header, seat and passenger lines. Throws on
+    // a malformed field before anything is added.
+    void loadTextFlight(const string& header, const string& seatLine, const string& passengerLine) {
+        Flight flight;
+        stringstream ss(header);
+        bool hasLayout = parseFlightHeader(ss, flight);
+        LegacySeatList seatList;
+        
+        // Load seat data
+        stringstream seatss(seatLine);
+        string seatData;
+        
+        while(getline(seatss, seatData, ';')) {
+            if(seatData.empty()) continue;
+            
+            stringstream seatStream(seatData);
+            string seatNumStr, isBookedStr, typeStr, basePriceStr;
+            
+            getline(seatStream, seatNumStr, ',');
+            getline(seatStream, isBookedStr, ',');
+            getline(seatStream, typeStr, ',');
+            getline(seatStream, basePriceStr, ',');
+            
+            seatList.add(stoi(seatNumStr), isBookedStr == "1",
+                         static_cast<SeatClass>(stoi(typeStr)), stod(basePriceStr));
+        }
+        seatList.finish();
+        
+        // Load passenger data
+        vector<Passenger> passengers;
+        stringstream passss(passengerLine);
+        string passData;
+        
+        while(getline(passss, passData, ';')) {
+            if(passData.empty()) continue;
+            
+            stringstream passStream(passData);
+            Passenger passenger;
+            string seatNumStr;
+            
+            getline(passStream, passenger.name, ',');
+            getline(passStream, passenger.email, ',');
+            getline(passStream, passenger.phone, ',');
+            getline(passStream, seatNumStr, ',');
+            getline(passStream, passenger.ticketNumber, ',');
+            passenger.seatNumber = stoi(seatNumStr);
+            passengers.push_back(passenger);
+        }
+        
+        if(!hasLayout) flight.setLayout(seatLayouts().match(seatList.cabins));
+        for(int seatNum : seatList.booked) {
+            flight.markSeatBooked(seatNum);
+        }
+        for(const auto& passenger : passengers) {
+            flight.passengers.push_back(passengerStore.add(passenger));
+        }
+        
+        flights.push_back(flight);
+    }
+    
+    // Self-contained blob for one flight - its record, passengers and strings
+    void encodeFlight(const Flight& flight, string& blob) const {
+        StringPoolWriter pool;
+        FlightRecord record = {};
+        record.flightNumber = pool.add(flight.flightNumber);
+        record.source = flight.source;
+        record.destination = flight.destination;
+        record.sourceTime = static_cast<uint32_t>(flight.sourceTime.minutes);
+        record.destinationTime = static_cast<uint32_t>(flight.destinationTime.minutes);
+        record.date = static_cast<uint32_t>(flight.date.day);
+        record.via = flight.via;
+        record.stops = flight.stops;
+        record.basePrice = flight.basePrice;
+        record.status = static_cast<int32_t>(flight.status);
+        record.layout = pool.add(flight.layout->id);
+        record.slot = flight.slot;
+        record.passengerCount = flight.passengers.size();
+        memcpy(record.bookedSeats, flight.bookedSeats, sizeof(record.bookedSeats));
+        
+        blob.clear();
+        blob.append(reinterpret_cast<const char*>(&record), sizeof(record));
+        for(PassengerId id : flight.passengers) {
+            PassengerRecord passengerRecord = {};
+            passengerRecord.name = pool.add(passengerStore.name(id));
+            passengerRecord.email = pool.add(passengerStore.email(id));
+            passengerRecord.phone = pool.add(passengerStore.phone(id));
+            passengerRecord.ticketNumber = pool.add(passengerStore.ticketNumber(id));
+            passengerRecord.seatNumber = passengerStore.seatNumber(id);
+            blob.append(reinterpret_cast<const char*>(&passengerRecord), sizeof(passengerRecord));
+        }
+        blob.append(pool.data);
+    }
+    
+    bool decodeFlight(const BlobReader& blob, const vector<AirportId>& airportIds, Flight& flight) {
+        FlightRecord record;
+        if(!blob.read(0, record) || !blob.fits(sizeof(record), record.passengerCount, sizeof(PassengerRecord))) return false;
+        uint64_t poolOffset = sizeof(record) + record.passengerCount * sizeof(PassengerRecord);
+        
+        auto airport = [&](uint32_t value) {
+            return value < airportIds.size() ? airportIds[value] : NO_AIRPORT;
+        };
+        
+        string layoutId;
+        if(!blob.str(poolOffset, record.flightNumber, flight.flightNumber) ||
+           !blob.str(poolOffset, record.layout, layoutId) ||
+           record.status < ON_TIME || record.status > CANCELED || record.stops < 0) return false;
+        flight.source = airport(record.source);
+        flight.destination = airport(record.destination);
+        flight.sourceTime = FlightTime(static_cast<int16_t>(record.sourceTime));
+        flight.destinationTime = FlightTime(static_cast<int16_t>(record.destinationTime));
+        flight.date = FlightDate(static_cast<int32_t>(record.date));
+        flight.via = airport(record.via);
+        flight.stops = record.stops;
+        flight.basePrice = record.basePrice;
+        flight.status = static_cast<FlightStatus>(record.status);
+        flight.slot = record.slot;
+        
+        const SeatLayout* layout = seatLayouts().find(layoutId);
+        if(!layout) {
+            cerr << "Unknown seat layout " << layoutId << " for flight " << flight.flightNumber
+                 << ", using " << seatLayouts().defaultLayout()->id << "." << endl;
+            layout = seatLayouts().defaultLayout();
+        }
+        flight.setLayout(layout);
+        memcpy(flight.bookedSeats, record.bookedSeats, sizeof(flight.bookedSeats));
+        flight.recountSeats();
+        
+        // Every passenger is checked before any is added, so a damaged record
+        // leaves nothing behind in the passenger store
+        struct PassengerView {
+            string_view name, email, phone, ticketNumber;
+            int seatNumber;
+        };
+        vector<PassengerView> views(record.passengerCount);
+        for(uint64_t i = 0; i < record.passengerCount; i++) {
+            PassengerRecord passengerRecord = {};
+            PassengerView& view = views[i];
+            blob.read(sizeof(record) + i * sizeof(PassengerRecord), passengerRecord);
+            if(!blob.view(poolOffset, passengerRecord.name, view.name) ||
+               !blob.view(poolOffset, passengerRecord.email, view.email) ||
+               !blob.view(poolOffset, passengerRecord.phone, view.phone) ||
+               !blob.view(poolOffset, passengerRecord.ticketNumber, view.ticketNumber)) return false;
+            view.seatNumber = passengerRecord.seatNumber;
+        }
+        
+        flight.passengers.reserve(views.size());
+        for(const PassengerView& view : views) {
+            flight.passengers.push_back(passengerStore.add(view.name, view.email, view.phone, view.ticketNumber, view.seatNumber));
+        }
+        return true;
+    }
+    
+    // Blob for the airport dictionary, indexed by airport ID
+    static void encodeAirports(string& blob) {
+        StringPoolWriter pool;
+        vector<uint32_t> names;
+        for(size_t id = 0; id < airports().size(); id++) {
+            names.push_back(pool.add(airports().name(static_cast<AirportId>(id))));
+        }
+        
+        uint32_t count = static_cast<uint32_t>(names.size());
+        blob.clear();
+        blob.append(reinterpret_cast<const char*>(&count), sizeof(count));
+        blob.append(reinterpret_cast<const char*>(names.data()), names.size() * sizeof(uint32_t));
+        blob.append(pool.data);
+    }
+    
+    // Store airport ID -> dictionary ID
+    static bool decodeAirports(const BlobReader& blob, vector<AirportId>& airportIds) {
+        uint32_t count;
+        if(!blob.read(0, count) || !blob.fits(sizeof(count), count, sizeof(uint32_t))) return false;
+        
+        uint64_t poolOffset = sizeof(count) + static_cast<uint64_t>(count) * sizeof(uint32_t);
+        airportIds.resize(count);
+        for(uint32_t i = 0; i < count; i++) {
+            uint32_t offset = 0;
+            string name;
+            blob.read(sizeof(count) + i * sizeof(uint32_t), offset);
+            if(!blob.str(poolOffset, offset, name)) return false;
+            airportIds[i] = airports().intern(name);
+        }
+        return true;
+    }
+    
+    // Add a blob to the pending data and point entry at where it will land
+    void appendBlob(const string& blob, StoreEntry& entry, string& data) {
+        entry.offset = storeDataSize;
+        entry.length = static_cast<uint32_t>(blob.size());
+        entry.used = blob.empty() ? 0 : 1;
+        data.append(blob);
+        
+        storeDataSize += blob.size();
+        storeLiveBytes += blob.size();
+        persistenceStats.checkpointBytes += blob.size();
+    }
+    
+    void releaseBlob(StoreEntry& entry) {
+        storeLiveBytes -= entry.length;
+        entry = StoreEntry();
+    }
+    
+    StoreHeader storeHeader() const {
+        StoreHeader header = {};
+        memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+        header.version = STORE_VERSION;
+        header.generation = storeGeneration;
+        header.dataSize = storeDataSize;
+        header.liveBytes = storeLiveBytes;
+        header.ticketSequence = reservedTicketSequence;
+        header.flightSlotSequence = nextFlightSlot;
+        header.flightSlotCount = flightEntries.size();
+        header.airports = airportEntry;
+        return header;
+    }
+    
+    // Encode what changed since the last save, or everything when full is
+    // set or the data file has grown well past what is still live. Called
+    // with storeMutex and the exclusive schedule lock held; nothing is
+    // written here, and the entries already point where writeSave puts the
+    // blobs. Should that fail, storeRewriteDue makes the next save whole.
+    void prepareSave(bool full, PendingSave& save) {
+        const uint64_t compactSlack = 1 << 20;
+        save.rewrite = full || storeGeneration == 0 || storeRewriteDue || storeDataSize > 2 * storeLiveBytes + compactSlack;
+        save.data.clear();
+        
+        string blob;
+        if(save.rewrite) {
+            storeDataSize = 0;
+            storeLiveBytes = 0;
+            flightEntries.assign(nextFlightSlot, StoreEntry());
+            save.dataOffset = 0;
+            encodeAirports(blob);
+            appendBlob(blob, airportEntry, save.data);
+            for(auto& flight : flights) {
+                encodeFlight(flight, blob);
+                appendBlob(blob, flightEntries[flight.slot], save.data);
+                flight.dirty = false;
+            }
+        } else {
+            save.dataOffset = storeDataSize;
+            if(airports().size() != storedAirportCount) {
+                releaseBlob(airportEntry);
+                encodeAirports(blob);
+                appendBlob(blob, airportEntry, save.data);
+            }
+            if(flightEntries.size() < nextFlightSlot) flightEntries.resize(nextFlightSlot, StoreEntry());
+            for(uint32_t slot : deletedSlots) {
+                releaseBlob(flightEntries[slot]);
+            }
+            for(auto& flight : flights) {
+                if(!flight.dirty) continue;
+                releaseBlob(flightEntries[flight.slot]);
+                encodeFlight(flight, blob);
+                appendBlob(blob, flightEntries[flight.slot], save.data);
+                flight.dirty = false;
+            }
+        }
+        storedAirportCount = airports().size();
+        deletedSlots.clear();
+        storeRewriteDue = false;
+        
+        save.header = storeHeader();
+        save.entries = flightEntries;
+        persistenceStats.checkpointBytes += sizeof(StoreHeader) + save.entries.size() * sizeof(StoreEntry);
+        
+        save.layouts = seatLayouts().customDefinitions();
+        save.hasWaitlists = full || waitlistsDirty;
+        if(save.hasWaitlists) {
+            waitlistsDirty = false;
+            save.waitlists = waitlistText();
+        }
+    }
+    
+    // The index is written whole to a temporary file and swapped in, so a
+    // crash leaves either the old index or the new one and never a header
+    // that disagrees with its entries
+    static bool writeStoreIndex(const StoreHeader& header, const vector<StoreEntry>& entries) {
+        string tempFile = string(STORE_INDEX_FILE) + ".tmp";
+        FILE* index = fopen(tempFile.c_str(), "wb");
+        if(!index) return false;
+        
+        bool ok = fwrite(&header, sizeof(header), 1, index) == 1 &&
+                  fwrite(entries.data(), sizeof(StoreEntry), entries.size(), index) == entries.size() &&
+                  syncFile(index);
+        fclose(index);
+        
+#ifdef _WIN32
+        if(ok) remove(STORE_INDEX_FILE);
+#endif
+        if(!ok || rename(tempFile.c_str(), STORE_INDEX_FILE) != 0) {
+            remove(tempFile.c_str());
+            return false;
+        }
+        return true;
+    }
+    
+    // Write a prepared save - layouts, waitlists, then the store. Runs with
+    // storeMutex held but not the schedule lock, so bookings carry on while
+    // the files are written and synced.
+    bool writeSave(PendingSave& save) {
+        if(!save.layouts.empty() && !writeTextFile(LAYOUT_FILE, save.layouts)) {
+            cerr << "Error saving seat layouts!" << endl;
+            storeRewriteDue = true;
+            waitlistsDirty = waitlistsDirty || save.hasWaitlists;
+            return false;
+        }
+        if(save.hasWaitlists && !writeTextFile(WAITLIST_FILE, save.waitlists)) {
+            cerr << "Error saving waitlists!" << endl;
+            storeRewriteDue = true;
+            waitlistsDirty = true;
+            return false;
+        }
+        
+        if(!(save.rewrite ? writeStoreGeneration(save) : appendStore(save))) {
+            // The entries in memory may no longer match the files
+            cerr << "Error saving flight data!" << endl;
+            storeRewriteDue = true;
+            return false;
+        }
+        return true;
+    }
+    
+    // Put the pending blobs in a new generation of the store, then swap the
+    // index over to it. Used for the first save, after loading text files,
+    // and to drop dead blobs once they outweigh live ones.
+    bool writeStoreGeneration(PendingSave& save) {
+        uint32_t oldGeneration = storeGeneration;
+        uint32_t generation = oldGeneration;
+        string dataFile;
+        
+        // Never write over a data file that is already there - it may belong
+        // to a store that could not be loaded
+        FILE* data = nullptr;
+        for(int attempt = 0; !data && attempt < 100; attempt++) {
+            dataFile = storeDataFile(++generation);
+            data = fopen(dataFile.c_str(), "wbx");
+        }
+        if(!data) return false;
+        
+        bool ok = fwrite(save.data.data(), 1, save.data.size(), data) == save.data.size() && syncFile(data);
+        fclose(data);
+        
+        save.header.generation = generation;
+        if(!ok || !writeStoreIndex(save.header, save.entries)) {
+            remove(dataFile.c_str());
+            return false;
+        }
+        
+        if(oldGeneration != 0) remove(storeDataFile(oldGeneration).c_str());
+        storeGeneration = generation;
+        return true;
+    }
+    
+    // Append the pending blobs to the current generation, then swap in an
+    // index pointing at them. Blobs go past the committed end of the data
+    // file, so an entry never points at bytes a later save overwrites, and
+    // the index is only replaced once everything it covers is on disk.
+    bool appendStore(const PendingSave& save) {
+        FILE* data = fopen(storeDataFile(storeGeneration).c_str(), "r+b");
+        if(!data) return false;
+        
+        bool ok = seekFile(data, save.dataOffset, SEEK_SET) &&
+                  fwrite(save.data.data(), 1, save.data.size(), data) == save.data.size() && syncFile(data);
+        fclose(data);
+        return ok && writeStoreIndex(save.header, save.entries);
+    }
+    
+    // Move a store that cannot be read out of the way, so the next save
+    // starts a new one instead of writing over what might still be recovered
+    static void setStoreAside(const string& dataFile) {
+        cerr << "Moved the damaged store aside as " << STORE_INDEX_FILE << ".damaged";
+        rename(STORE_INDEX_FILE, (string(STORE_INDEX_FILE) + ".damaged").c_str());
+        if(!dataFile.empty() && rename(dataFile.c_str(), (dataFile + ".damaged").c_str()) == 0) {
+            cerr << " and " << dataFile << ".damaged";
+        }
+        cerr << "." << endl;
+    }
+    
+    bool loadStore() {
+        MappedFile indexFile;
+        if(!indexFile.open(STORE_INDEX_FILE)) {
+            cerr << "Store index " << STORE_INDEX_FILE << " is empty or cannot be read." << endl;
+            setStoreAside("");
+            return false;
+        }
+        
+        StoreHeader header;
+        BlobReader index = {indexFile.begin(), indexFile.size()};
+        if(!index.read(0, header) || memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) != 0 ||
+           header.version != STORE_VERSION) {
+            cerr << "Unsupported store format in " << STORE_INDEX_FILE << "." << endl;
+            indexFile.close();
+            setStoreAside("");
+            return false;
+        }
+        
+        string dataFile = storeDataFile(header.generation);
+        if(!index.fits(sizeof(header), header.flightSlotCount, sizeof(StoreEntry))) {
+            cerr << "Store index " << STORE_INDEX_FILE << " is truncated." << endl;
+            indexFile.close();
+            setStoreAside(dataFile);
+            return false;
+        }
+        
+        MappedFile dataMap;
+        if(!dataMap.open(dataFile.c_str())) {
+            cerr << "Store data " << dataFile << " is missing." << endl;
+            indexFile.close();
+            setStoreAside(dataFile);
+            return false;
+        }
+        
+        vector<StoreEntry> flightTable(header.flightSlotCount);
+        memcpy(flightTable.data(), indexFile.begin() + sizeof(header), flightTable.size() * sizeof(StoreEntry));
+        indexFile.close();
+        
+        // Entries are checked against the data file as it is, not against
+        // the size the header recorded
+        auto blobAt = [&](const StoreEntry& entry, BlobReader& blob) {
+            if(entry.offset > dataMap.size() || entry.length > dataMap.size() - entry.offset) return false;
+            blob.data = dataMap.begin() + entry.offset;
+            blob.length = entry.length;
+            return true;
+        };
+        
+        BlobReader blob;
+        vector<AirportId> airportIds;
+        if(!blobAt(header.airports, blob) || !decodeAirports(blob, airportIds)) {
+            cerr << "Airport table in " << dataFile << " is damaged." << endl;
+            dataMap.close();
+            setStoreAside(dataFile);
+            return false;
+        }
+        
+        // A flight whose blob does not decode damages the whole store - the
+        // blob is the only copy of its passengers, and a later save would
+        // drop it with the old generation
+        clearFlights();
+        for(uint64_t slot = 0; slot < flightTable.size(); slot++) {
+            if(!flightTable[slot].used) continue;
+            
+            Flight flight;
+            if(!blobAt(flightTable[slot], blob) || !decodeFlight(blob, airportIds, flight) || flight.slot != slot) {
+                cerr << "Flight in slot " << slot << " of " << dataFile << " is damaged." << endl;
+                clearFlights();
+                dataMap.close();
+                setStoreAside(dataFile);
+                return false;
+            }
+            flights.push_back(move(flight));
+        }
+        
+        reservedTicketSequence = max<uint64_t>(reservedTicketSequence, header.ticketSequence);
+        nextFlightSlot = max<uint64_t>(nextFlightSlot, header.flightSlotSequence);
+        
+        storeGeneration = header.generation;
+        storeDataSize = header.dataSize;
+        storeLiveBytes = header.liveBytes;
+        airportEntry = header.airports;
+        flightEntries = move(flightTable);
+        storedAirportCount = airportIds.size();
+        return true;
+    }
+    
+    void loadFareCurves() {
+        string active;
+        fareCurves().loadFile(FARE_FILE, active);
+        if(active.empty()) return;
+        
+        const FareCurve* curve = fareCurves().find(active);
+        if(curve) {
+            fareCurve = curve;
+        } else {
+            cerr << "Unknown fare curve " << active << ", using " << fareCurve->id << "." << endl;
+        }
+    }
+    
+    // waitlist.txt - the next entry number, then one entry per line as in
+    // the journal's W records
+    string waitlistText() const {
+        string text = "NEXT|" + to_string(nextWaitlistId) + "\n";
+        for(const auto& flight : flights) {
+            if(flight.slot >= waitlists.size() || !waitlists[flight.slot]) continue;
+            for(const auto& entry : waitlists[flight.slot]->ordered()) {
+                text += formatWaitlistEntry(flight, entry);
+                text += '\n';
+            }
+        }
+        return text;
+    }
+    
+    void loadWaitlists() {
+        ifstream file(WAITLIST_FILE);
+        string line;
+        while(getline(file, line)) {
+            if(!line.empty() && line.back() == '\r') line.pop_back();
+            if(line.empty()) continue;
+            
+            stringstream ss(line);
+            try {
+                if(line.compare(0, 5, "NEXT|") == 0) {
+                    nextWaitlistId = max<uint64_t>(nextWaitlistId, stoull(line.substr(5)));
+                    continue;
+                }
+                applyWaitlistEntry(ss);
+            } catch(const exception&) {
+                cerr << "Ignoring invalid waitlist entry: " << line << endl;
+            }
+        }
+    }
+    
+    static string formatWaitlistEntry(const Flight& flight, const WaitlistEntry& entry) {
+        return flight.flightNumber + "|" + to_string(entry.id) + "|" + to_string(static_cast<int>(entry.tier)) + "|" +
+               to_string(static_cast<int>(entry.seatClass)) + "|" + entry.name + "|" + entry.email + "|" + entry.phone;
+    }
+    
+    // Add an entry as written by formatWaitlistEntry, unless it is there already
+    void applyWaitlistEntry(stringstream& ss) {
+        string flightNumber, idStr, tierStr, classStr;
+        WaitlistEntry entry;
+        getline(ss, flightNumber, '|');
+        getline(ss, idStr, '|');
+        getline(ss, tierStr, '|');
+        getline(ss, classStr, '|');
+        getline(ss, entry.name, '|');
+        getline(ss, entry.email, '|');
+        getline(ss, entry.phone, '|');
+        entry.id = stoull(idStr);
+        entry.tier = static_cast<LoyaltyTier>(stoi(tierStr));
+        entry.seatClass = static_cast<SeatClass>(stoi(classStr));
+        
+        nextWaitlistId = max<uint64_t>(nextWaitlistId, entry.id + 1);
+        Flight* flight = findFlight(flightNumber);
+        if(flight) flightWaitlist(*flight).add(entry);
+    }
+    
+    // The text files are read only when there is no store yet, and are
+    // rewritten into one on the next save. A store that exists but cannot be
+    // read is never replaced by them - flights.txt is whatever was last
+    // exported, and loading it would lose everything since. The system then
+    // starts empty and saves nothing, and the operator recovers the store or
+    // replaces it with --import-text.
+    bool loadSnapshot() {
+        string damagedIndex = string(STORE_INDEX_FILE) + ".damaged";
+        if(ifstream(STORE_INDEX_FILE).is_open()) {
+            if(!loadStore()) {
+                cerr << "Cannot load the store. Recover it from the .damaged files, "
+                     << "or run with --import-text to replace it with flights.txt." << endl;
+                return false;
+            }
+        } else if(ifstream(damagedIndex).is_open()) {
+            cerr << "The store was set aside as " << damagedIndex << ". Recover it, "
+                 << "or run with --import-text to replace it with flights.txt." << endl;
+            return false;
+        } else {
+            storeRewriteDue = true;
+            loadTextSnapshot();
+        }
+        rebuildIndexes();
+        return true;
+    }
+    
+    void loadData() {
+        seatLayouts().loadFile(LAYOUT_FILE);
+        loadFareCurves();
+        connectionRules.loadFile(CONNECTION_FILE);
+        if(!loadSnapshot()) {
+            // Only the journal's ticket blocks are applied, so an import does
+            // not hand out numbers that were already issued
+            storeUnreadable = true;
+            replayJournal(true);
+            nextTicketSequence = reservedTicketSequence.load();
+            return;
+        }
+        loadWaitlists();
+        replayJournal();
+        
+        // Whatever is left of the last reserved block is skipped, it may have been used
+        nextTicketSequence = reservedTicketSequence.load();
+    }
+    
+    static uint64_t routeKey(AirportId source, AirportId destination) {
+        return (static_cast<uint64_t>(source) << 32) | destination;
+    }
+    
+    void indexRoute(size_t flightPos) {
+        const Flight& flight = flights[flightPos];
+        routeIndex[routeKey(flight.source, flight.destination)].push_back(flightPos);
+    }
+    
+    // Give the flight's route a calendar and the flight its share of it. Only
+    // under the exclusive schedule lock, the one place calendars are added.
+    void ensureCalendar(const Flight& flight) {
+        unique_ptr<RouteCalendar>& calendar = routeCalendars[routeKey(flight.source, flight.destination)];
+        if(!calendar) calendar.reset(new RouteCalendar());
+        summarizeFlight(flight);
+    }
+    
+    // Bring the flight's share of its route calendar up to date. Called with
+    // the flight's lock held after every change to its seats or status; the
+    // calendar was added when the flight was indexed, so this only looks it up.
+    void summarizeFlight(const Flight& flight) {
+        if(!flight.date.valid()) return;
+        auto calendar = routeCalendars.find(routeKey(flight.source, flight.destination));
+        if(calendar == routeCalendars.end()) return;
+        
+        FlightQuote quote = quoteFlight(flight);
+        lock_guard<mutex> guard(calendar->second->lock);
+        calendar->second->set(flight.date, flight.slot, flight.seatCount - flight.bookedCount, quote.lowestFare,
+                              flight.status == CANCELED);
+    }
+    
+    void unsummarizeFlight(const Flight& flight) {
+        auto calendar = routeCalendars.find(routeKey(flight.source, flight.destination));
+        if(calendar == routeCalendars.end()) return;
+        
+        lock_guard<mutex> guard(calendar->second->lock);
+        calendar->second->remove(flight.date, flight.slot);
+    }
+    
+    void unindexRoute(size_t flightPos) {
+        const Flight& flight = flights[flightPos];
+        auto route = routeIndex.find(routeKey(flight.source, flight.destination));
+        if(route == routeIndex.end()) return;
+        
+        vector<size_t>& positions = route->second;
+        positions.erase(remove(positions.begin(), positions.end(), flightPos), positions.end());
+        if(positions.empty()) routeIndex.erase(route);
+    }
+    
+    void indexFlight(size_t flightPos) {
+        const Flight& flight = flights[flightPos];
+        scheduleVersion++;
+        flightIndex[flight.flightNumber] = flightPos;
+        indexRoute(flightPos);
+        departureIndex.insert(make_pair(flight.departureKey(), flightPos));
+        if(flight.slot >= slotIndex.size()) slotIndex.resize(flight.slot + 1, NO_FLIGHT);
+        if(flight.slot >= waitlists.size()) waitlists.resize(flight.slot + 1);
+        slotIndex[flight.slot] = flightPos;
+        ensureCalendar(flight);
+        for(size_t i = 0; i < flight.passengers.size(); i++) {
+            ticketIndex.set(string(passengerStore.ticketNumber(flight.passengers[i])), TicketHandle{flightPos, i});
+            passengerStore.setFlightSlot(flight.passengers[i], flight.slot);
+        }
+    }
+    
+    void unindexFlight(size_t flightPos) {
+        const Flight& flight = flights[flightPos];
+        scheduleVersion++;
+        flightIndex.erase(flight.flightNumber);
+        unindexRoute(flightPos);
+        departureIndex.erase(make_pair(flight.departureKey(), flightPos));
+        slotIndex[flight.slot] = NO_FLIGHT;
+        unsummarizeFlight(flight);
+        for(PassengerId id : flight.passengers) {
+            ticketIndex.erase(string(passengerStore.ticketNumber(id)));
+        }
+    }
+    
+    void rebuildIndexes() {
+        flightIndex.clear();
+        ticketIndex.clear();
+        customerIndex.clear();
+        routeIndex.clear();
+        routeCalendars.clear();
+        departureIndex.clear();
+        slotIndex.clear();
+        
+        // Flights from files written before slots existed get one now, and
+        // issued ticket numbers push the high-water mark up in case the
+        // snapshot did not carry it (text imports). Passengers are gathered
+        // in issue order for the customer index - older ticket numbers that
+        // carry no sequence first, then by sequence.
+        vector<pair<uint64_t, PassengerId>> issued;
+        vector<PassengerId> unsequenced;
+        for(auto& flight : flights) {
+            nextFlightSlot = max(nextFlightSlot, flight.slot + 1);
+            for(PassengerId id : flight.passengers) {
+                uint64_t sequence;
+                uint32_t slot;
+                if(parseTicketNumber(passengerStore.ticketNumber(id), sequence, slot)) {
+                    reservedTicketSequence = max<uint64_t>(reservedTicketSequence, sequence + 1);
+                    issued.emplace_back(sequence, id);
+                } else {
+                    unsequenced.push_back(id);
+                }
+            }
+        }
+        for(auto& flight : flights) {
+            if(flight.slot == 0) flight.slot = nextFlightSlot++;
+        }
+        
+        for(size_t i = 0; i < flights.size(); i++) {
+            indexFlight(i);
+        }
+        
+        // The customer index is not touched when flights move between
+        // positions, only when bookings come and go, so it is built here once
+        sort(unsequenced.begin(), unsequenced.end(), [&](PassengerId a, PassengerId b) {
+            return passengerStore.ticketNumber(a) < passengerStore.ticketNumber(b);
+        });
+        sort(issued.begin(), issued.end());
+        customerIndex.reserve(unsequenced.size() + issued.size());
+        auto indexCustomer = [&](PassengerId id) {
+            customerIndex.update(string(passengerStore.phone(id)), [&](vector<PassengerId>& bookings) {
+                bookings.push_back(id);
+            });
+        };
+        for(PassengerId id : unsequenced) indexCustomer(id);
+        for(const auto& booking : issued) indexCustomer(booking.second);
+    }
+    
+    // Ticket numbers are TKT<sequence>-<flight slot>. Sequences come from a
+    // single atomic counter, and a block of them is reserved in the journal
+    // before any is used, so a number is never handed out twice - not across
+    // threads and not across restarts.
+    string allocateTicketNumber(const Flight& flight) {
+        uint64_t sequence = nextTicketSequence.fetch_add(1, memory_order_relaxed);
+        if(sequence >= reservedTicketSequence.load(memory_order_acquire)) reserveTicketBlock(sequence);
+        return "TKT" + to_string(sequence) + "-" + to_string(flight.slot);
+    }
+    
+    void reserveTicketBlock(uint64_t sequence) {
+        lock_guard<mutex> guard(ticketBlockMutex);
+        if(sequence < reservedTicketSequence.load()) return;
+        
+        uint64_t blockEnd = sequence + TICKET_BLOCK_SIZE;
+        journalTicketBlock(blockEnd);
+        reservedTicketSequence.store(blockEnd, memory_order_release);
+    }
+    
+    // Older ticket numbers carry no slot and do not parse
+    static bool parseTicketNumber(string_view ticketNumber, uint64_t& sequence, uint32_t& slot) {
+        size_t dash = ticketNumber.find('-');
+        if(ticketNumber.compare(0, 3, "TKT") != 0 || dash == string::npos || dash == 3 || dash + 1 == ticketNumber.size()) {
+            return false;
+        }
+        
+        sequence = 0;
+        for(size_t i = 3; i < dash; i++) {
+            if(!isdigit(static_cast<unsigned char>(ticketNumber[i]))) return false;
+            sequence = sequence * 10 + (ticketNumber[i] - '0');
+        }
+        uint64_t slotValue = 0;
+        for(size_t i = dash + 1; i < ticketNumber.size(); i++) {
+            if(!isdigit(static_cast<unsigned char>(ticketNumber[i])) || slotValue > UINT32_MAX) return false;
+            slotValue = slotValue * 10 + (ticketNumber[i] - '0');
+        }
+        slot = static_cast<uint32_t>(slotValue);
+        return true;
+    }
+    
+    // Position of the flight a ticket was issued on, straight from its number
+    bool ticketFlight(const string& ticketNumber, size_t& flightPos) const {
+        uint64_t sequence;
+        uint32_t slot;
+        if(!parseTicketNumber(ticketNumber, sequence, slot) || slot >= slotIndex.size()) return false;
+        
+        flightPos = slotIndex[slot];
+        return flightPos != NO_FLIGHT;
+    }
+    
+    // Positions of all flights on a route, in the order they were indexed
+    const vector<size_t>& findRoute(AirportId source, AirportId destination) const {
+        static const vector<size_t> none;
+        auto route = routeIndex.find(routeKey(source, destination));
+        return (route != routeIndex.end()) ? route->second : none;
+    }
+    
+    // Replace a flight's schedule details, keeping its seats and passengers
+    void applyFlightDetails(Flight& flight, const Flight& details) {
+        size_t flightPos = &flight - flights.data();
+        bool routeChanged = flight.source != details.source || flight.destination != details.destination;
+        
+        if(routeChanged) unindexRoute(flightPos);
+        departureIndex.erase(make_pair(flight.departureKey(), flightPos));
+        unsummarizeFlight(flight);
+        scheduleVersion++;
+        flight.source = details.source;
+        flight.destination = details.destination;
+        flight.sourceTime = details.sourceTime;
+        flight.destinationTime = details.destinationTime;
+        flight.date = details.date;
+        flight.basePrice = details.basePrice;
+        flight.via = details.via;
+        flight.stops = details.stops;
+        flight.status = details.status;
+        flight.dirty = true;
+        departureIndex.insert(make_pair(flight.departureKey(), flightPos));
+        if(routeChanged) indexRoute(flightPos);
+        ensureCalendar(flight);
+    }
+    
+    // Drop every flight along with its passengers
+    void clearFlights() {
+        flights.clear();
+        routeCalendars.clear();
+        waitlists.clear();
+        waitlistsDirty = true;
+        scheduleVersion++;
+        passengerStore.clear();
+    }
+    
+    Flight* findFlight(const string& flightNumber) {
+        auto it = flightIndex.find(flightNumber);
+        return (it != flightIndex.end()) ? &flights[it->second] : nullptr;
+    }
+    
+    bool findTicket(const string& ticketNumber, TicketHandle& handle) const {
+        return ticketIndex.find(ticketNumber, handle);
+    }
+    
+    // Flights without a slot get the next free one
+    void appendFlight(const Flight& flight) {
+        flights.push_back(flight);
+        if(flights.back().slot == 0) flights.back().slot = nextFlightSlot++;
+        nextFlightSlot = max(nextFlightSlot, flights.back().slot + 1);
+        flights.back().dirty = true;
+        indexFlight(flights.size() - 1);
+    }
+    
+    // Remove a flight by moving the last flight into its slot, so only
+    // the two affected flights are re-indexed
+    void eraseFlight(size_t flightPos) {
+        size_t last = flights.size() - 1;
+        deletedSlots.push_back(flights[flightPos].slot);
+        if(flights[flightPos].slot < waitlists.size() && waitlists[flights[flightPos].slot]) {
+            waitlists[flights[flightPos].slot].reset();
+            waitlistsDirty = true;
+        }
+        unindexFlight(flightPos);
+        for(PassengerId id : flights[flightPos].passengers) {
+            unindexCustomer(id);
+            passengerStore.remove(id);
+        }
+        if(flightPos != last) {
+            unindexFlight(last);
+            flights[flightPos] = flights[last];
+            indexFlight(flightPos);
+        }
+        flights.pop_back();
+    }
+    
+    // Under the flight lock
+    Waitlist& flightWaitlist(const Flight& flight) {
+        unique_ptr<Waitlist>& waitlist = waitlists[flight.slot];
+        if(!waitlist) waitlist.reset(new Waitlist());
+        return *waitlist;
+    }
+    
+    // Give a seat that just came free to the first passenger waiting for its
+    // class, under the flight lock. Anyone in line who has meanwhile got a
+    // seat on the flight some other way is dropped on the way.
+    bool promoteWaitlisted(Flight& flight, int seatNumber, string& ticketNumber) {
+        if(flight.slot >= waitlists.size() || !waitlists[flight.slot] || waitlists[flight.slot]->empty()) return false;
+        if(flight.status == CANCELED || !flight.isSeatAvailable(seatNumber)) return false;
+        
+        Waitlist& waitlist = *waitlists[flight.slot];
+        SeatClass seatClass = flight.layout->cabinOf(seatNumber).type;
+        while(const WaitlistEntry* next = waitlist.next(seatClass)) {
+            WaitlistEntry entry = *next;
+            waitlist.remove(entry.id);
+            waitlistsDirty = true;
+            if(hasDuplicateBooking(flight, entry.name, entry.phone)) {
+                journalLeaveWaitlist(flight, entry.id);
+                continue;
+            }
+            
+            Passenger booked(entry.name, entry.email, entry.phone, seatNumber);
+            do {
+                booked.ticketNumber = allocateTicketNumber(flight);
+            } while(!claimTicket(flight, booked.ticketNumber));
+            addPassenger(flight, booked);
+            journalPromotion(flight, entry.id, booked);
+            ticketNumber = booked.ticketNumber;
+            return true;
+        }
+        return false;
+    }
+    
+    // Whether the seat can be booked or held right now - BOOKED if it can
+    BookingResult checkSeat(const Flight& flight, int seatNumber) const {
+        if(flight.status == CANCELED) return FLIGHT_CANCELED;
+        if(seatNumber < 1 || seatNumber > flight.seatCount) return INVALID_SEAT;
+        if(flight.isSeatBooked(seatNumber)) return SEAT_TAKEN;
+        if(flight.isSeatHeld(seatNumber)) return SEAT_ON_HOLD;
+        return BOOKED;
+    }
+    
+    // Add the passenger on a seat already checked, under the flight lock
+    void issueBooking(Flight& flight, int seatNumber, const string& name, const string& email, const string& phone,
+                      Passenger& booked, double& price) {
+        price = fareCurve->quoteSeat(flight, seatNumber);
+        booked = Passenger(name, email, phone, seatNumber);
+        do {
+            booked.ticketNumber = allocateTicketNumber(flight);
+        } while(!claimTicket(flight, booked.ticketNumber));
+        addPassenger(flight, booked);
+        journalBooking(flight, booked);
+    }
+    
+    uint64_t holdTick() const {
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - holdEpoch).count()) / HOLD_TICK_MS;
+    }
+    
+    static uint64_t holdPayload(uint32_t flightSlot, int seatNumber) {
+        return (static_cast<uint64_t>(flightSlot) << 16) | static_cast<uint64_t>(seatNumber);
+    }
+    
+    // Flight position and seat of a pending hold, under the schedule lock
+    bool findHold(uint64_t token, size_t& flightPos, int& seatNumber) {
+        uint64_t payload, deadline;
+        {
+            lock_guard<mutex> holdGuard(holdMutex);
+            if(!holdWheel.find(token, payload, deadline)) return false;
+        }
+        uint32_t slot = static_cast<uint32_t>(payload >> 16);
+        if(slot >= slotIndex.size() || slotIndex[slot] == NO_FLIGHT) return false;
+        flightPos = slotIndex[slot];
+        seatNumber = static_cast<int>(payload & 0xFFFF);
+        return true;
+    }
+    
+    // Take the holds whose time is up off the wheel, then clear their seats
+    // flight by flight. A seat stays held until its flight is reached, so
+    // nobody else can claim it in between.
+    void expireHolds() {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        vector<uint64_t> expired;
+        {
+            lock_guard<mutex> holdGuard(holdMutex);
+            if(holdWheel.size() == 0) return;
+            holdWheel.advance(holdTick(), [&](uint64_t, uint64_t payload) { expired.push_back(payload); });
+        }
+        
+        for(uint64_t payload : expired) {
+            uint32_t slot = static_cast<uint32_t>(payload >> 16);
+            if(slot >= slotIndex.size() || slotIndex[slot] == NO_FLIGHT) continue; // flight deleted meanwhile
+            
+            size_t flightPos = slotIndex[slot];
+            int seatNumber = static_cast<int>(payload & 0xFFFF);
+            string promotedTicket;
+            lock_guard<mutex> guard(flightLock(flightPos));
+            flights[flightPos].setSeatHeld(seatNumber, false);
+            promoteWaitlisted(flights[flightPos], seatNumber, promotedTicket);
+        }
+    }
+    
+    void holdReaperLoop() {
+        unique_lock<mutex> holdGuard(holdMutex);
+        while(!holdStopping) {
+            if(holdWheel.size() == 0) {
+                holdWork.wait(holdGuard);
+                continue;
+            }
+            holdWork.wait_for(holdGuard, chrono::milliseconds(HOLD_TICK_MS));
+            holdGuard.unlock();
+            expireHolds();
+            holdGuard.lock();
+        }
+    }
+    
+    // Claim a ticket number for the passenger about to be added to a flight.
+    // Fails if another booking already holds that number.
+    bool claimTicket(const Flight& flight, const string& ticketNumber) {
+        size_t flightPos = &flight - flights.data();
+        return ticketIndex.insert(ticketNumber, TicketHandle{flightPos, flight.passengers.size()});
+    }
+    
+    // Apply a booking to the in-memory state once its ticket has been claimed
+    void addPassenger(Flight& flight, const Passenger& passenger) {
+        PassengerId id = passengerStore.add(passenger);
+        passengerStore.setFlightSlot(id, flight.slot);
+        flight.passengers.push_back(id);
+        flight.markSeatBooked(passenger.seatNumber);
+        flight.dirty = true;
+        summarizeFlight(flight);
+        customerIndex.update(passenger.phone, [&](vector<PassengerId>& bookings) {
+            bookings.push_back(id);
+        });
+    }
+    
+    // Drop a booking from its customer's entry, and the entry once it is empty
+    void unindexCustomer(PassengerId id) {
+        customerIndex.updateOrErase(string(passengerStore.phone(id)), [&](vector<PassengerId>& bookings) {
+            bookings.erase(remove(bookings.begin(), bookings.end(), id), bookings.end());
+            return !bookings.empty();
+        });
+    }
+    
+    // Apply a cancellation to the in-memory state. The last passenger is
+    // moved into the freed slot so the index only changes for that one.
+    void removePassenger(const TicketHandle& handle) {
+        Flight& flight = flights[handle.flight];
+        PassengerId& id = flight.passengers[handle.passenger];
+        string ticketNumber(passengerStore.ticketNumber(id));
+        
+        unindexCustomer(id);
+        flight.markSeatAvailable(passengerStore.seatNumber(id));
+        flight.dirty = true;
+        summarizeFlight(flight);
+        ticketIndex.erase(ticketNumber);
+        passengerStore.remove(id);
+        
+        size_t last = flight.passengers.size() - 1;
+        if(handle.passenger != last) {
+            id = flight.passengers[last];
+            ticketIndex.set(string(passengerStore.ticketNumber(id)), handle);
+        }
+        flight.passengers.pop_back();
+    }
+    
+    // Every mutation is appended to the journal as one record instead of
+    // rewriting the whole snapshot. The journal is replayed on top of the
+    // snapshot at startup and compacted into it by checkpoints. Callers still
+    // hold their locks here, so the record is only queued; the worker writes it.
+    void appendJournal(const string& record) {
+        if(!persistent) return;
+        
+        lock_guard<mutex> guard(journalMutex);
+        pendingRecords += record;
+        pendingRecords += '\n';
+        pendingCount++;
+        lastJournalRecord.system = this;
+        lastJournalRecord.sequence = nextJournalSequence++;
+        persistenceStats.mutations++;
+        persistenceStats.journalBytes += record.size() + 1;
+        journalWork.notify_one();
+    }
+    
+    bool writeJournal(const string& batch) {
+        if(!journalFile) journalFile = fopen(JOURNAL_FILE, "ab");
+        if(!journalFile) return false;
+        return fwrite(batch.data(), 1, batch.size(), journalFile) == batch.size() && syncFile(journalFile);
+    }
+    
+    // Persistence worker - drains the queue in batches, so a burst of
+    // bookings costs one fsync, and runs checkpoints off the booking path
+    void persistenceLoop() {
+        unique_lock<mutex> guard(journalMutex);
+        while(true) {
+            journalWork.wait(guard, [&]() { return !pendingRecords.empty() || checkpointRequested || stopping; });
+            
+            if(!pendingRecords.empty()) {
+                string batch;
+                batch.swap(pendingRecords);
+                size_t count = pendingCount;
+                uint64_t batchEnd = nextJournalSequence;
+                pendingCount = 0;
+                
+                guard.unlock();
+                bool written = writeJournal(batch);
+                guard.lock();
+                
+                if(!written) {
+                    cerr << "Error writing booking journal!" << endl;
+                    journalFailed = true;
+                }
+                persistenceStats.journalSyncs++;
+                durableSequence = batchEnd;
+                journalRecords += static_cast<int>(count);
+                if(journalRecords >= JOURNAL_CHECKPOINT_INTERVAL) checkpointRequested = true;
+                journalSynced.notify_all();
+            }
+            
+            if(checkpointRequested || (stopping && pendingRecords.empty())) {
+                checkpointRequested = false;
+                guard.unlock();
+                runCheckpoint();
+                guard.lock();
+                checkpointsDone++;
+                journalSynced.notify_all();
+            }
+            
+            if(stopping && pendingRecords.empty()) break;
+        }
+    }
+    
+    // Compact the journal into the store. Runs on the worker and waits for
+    // every booking in flight to finish, but only while the changed flights
+    // are encoded - the writes and syncs happen after the schedule lock is
+    // released. Records queued before the lock was taken are already
+    // applied, so the store covers them too; later ones stay queued for the
+    // fresh journal.
+    void runCheckpoint() {
+        lock_guard<mutex> store(storeMutex);
+        if(storeUnreadable) return;
+        
+        PendingSave save;
+        string batch;
+        uint64_t batchEnd;
+        {
+            unique_lock<shared_mutex> schedule(scheduleMutex);
+            {
+                lock_guard<mutex> guard(journalMutex);
+                batch.swap(pendingRecords);
+                batchEnd = nextJournalSequence;
+                pendingCount = 0;
+            }
+            prepareSave(false, save);
+        }
+        
+        bool saved = writeSave(save);
+        bool journaled = saved || writeJournal(batch);
+        if(!journaled) cerr << "Error writing booking journal!" << endl;
+        if(saved) {
+            if(journalFile) fclose(journalFile);
+            journalFile = fopen(JOURNAL_FILE, "wb");
+            
+            // The fresh journal opens with the ticket high-water mark, so
+            // sequences never go back even if the store is lost
+            if(!writeJournal("T|" + to_string(reservedTicketSequence.load()) + "\n")) {
+                cerr << "Error writing booking journal!" << endl;
+            }
+        }
+        
+        lock_guard<mutex> guard(journalMutex);
+        durableSequence = batchEnd;
+        if(!journaled) journalFailed = true;
+        if(saved) {
+            persistenceStats.checkpoints++;
+            journalRecords = 0;
+            journalFailed = false;
+        }
+    }
+    
+    // Have the worker checkpoint and wait until it has
+    void checkpoint() {
+        if(!persistent) return;
+        
+        unique_lock<mutex> guard(journalMutex);
+        uint64_t target = checkpointsDone + 1;
+        checkpointRequested = true;
+        journalWork.notify_one();
+        journalSynced.wait(guard, [&]() { return checkpointsDone >= target; });
+    }
+    
+    // Called by every mutating operation once its locks are released. Under
+    // SYNC_COMMIT it returns only when the operation's record is on disk.
+    // Passenger strings are compacted here rather than at checkpoints so it
+    // happens on the thread that made the change, never under a menu that is
+    // still reading.
+    void commitMutation() {
+        if(passengerStore.compactDue()) {
+            unique_lock<shared_mutex> schedule(scheduleMutex);
+            if(passengerStore.compactDue()) passengerStore.compact();
+        }
+        if(durabilityPolicy == SYNC_COMMIT) awaitDurable();
+    }
+    
+    void journalBooking(const Flight& flight, const Passenger& passenger) {
+        stringstream ss;
+        ss << "B|" << flight.flightNumber << "|"
+           << passenger.seatNumber << "|"
+           << passenger.name << "|"
+           << passenger.email << "|"
+           << passenger.phone << "|"
+           << passenger.ticketNumber;
+        appendJournal(ss.str());
+    }
+    
+    void journalGroup(const Flight& flight, const vector<Passenger>& party) {
+        stringstream ss;
+        ss << "G|" << flight.flightNumber << "|" << party.size();
+        for(const auto& member : party) {
+            ss << "|" << member.seatNumber << "|"
+               << member.name << "|"
+               << member.email << "|"
+               << member.phone << "|"
+               << member.ticketNumber;
+        }
+        appendJournal(ss.str());
+    }
+    
+    void journalJoinWaitlist(const Flight& flight, const WaitlistEntry& entry) {
+        appendJournal("W|" + formatWaitlistEntry(flight, entry));
+    }
+    
+    void journalLeaveWaitlist(const Flight& flight, uint64_t id) {
+        appendJournal("L|" + flight.flightNumber + "|" + to_string(id));
+    }
+    
+    void journalPromotion(const Flight& flight, uint64_t id, const Passenger& passenger) {
+        appendJournal("P|" + flight.flightNumber + "|" + to_string(id) + "|" + to_string(passenger.seatNumber) + "|" +
+                      passenger.ticketNumber);
+    }
+    
+    void journalCancel(const string& ticketNumber) {
+        appendJournal("C|" + ticketNumber);
+    }
+    
+    void journalAddFlight(const Flight& flight) {
+        appendJournal("A|" + formatFlightHeader(flight));
+    }
+    
+    void journalModifyFlight(const Flight& flight) {
+        appendJournal("M|" + formatFlightHeader(flight));
+    }
+    
+    void journalDeleteFlight(const string& flightNumber) {
+        appendJournal("D|" + flightNumber);
+    }
+    
+    void journalTicketBlock(uint64_t blockEnd) {
+        appendJournal("T|" + to_string(blockEnd));
+    }
+    
+    void journalStatus(const Flight& flight) {
+        appendJournal("S|" + flight.flightNumber + "|" + to_string(static_cast<int>(flight.status)));
+    }
+    
+    // Records are idempotent so a journal that survived a checkpoint
+    // interrupted before truncation can be replayed again safely.
+    void applyJournalRecord(const string& line) {
+        stringstream ss(line);
+        string op;
+        getline(ss, op, '|');
+        
+        if(op == "B") {
+            string flightNumber, seatStr, name, email, phone, ticketNumber;
+            getline(ss, flightNumber, '|');
+            getline(ss, seatStr, '|');
+            getline(ss, name, '|');
+            getline(ss, email, '|');
+            getline(ss, phone, '|');
+            getline(ss, ticketNumber, '|');
+            
+            Flight* flight = findFlight(flightNumber);
+            int seatNumber = stoi(seatStr);
+            if(!flight || !flight->isSeatAvailable(seatNumber) || !claimTicket(*flight, ticketNumber)) return;
+            
+            Passenger passenger;
+            passenger.name = name;
+            passenger.email = email;
+            passenger.phone = phone;
+            passenger.seatNumber = seatNumber;
+            passenger.ticketNumber = ticketNumber;
+            addPassenger(*flight, passenger);
+        } else if(op == "G") {
+            string flightNumber, countStr;
+            getline(ss, flightNumber, '|');
+            getline(ss, countStr, '|');
+            
+            Flight* flight = findFlight(flightNumber);
+            if(!flight) return;
+            
+            // The whole group or none of it
+            vector<Passenger> party(stoi(countStr));
+            TicketHandle handle;
+            for(auto& member : party) {
+                string seatStr;
+                getline(ss, seatStr, '|');
+                getline(ss, member.name, '|');
+                getline(ss, member.email, '|');
+                getline(ss, member.phone, '|');
+                getline(ss, member.ticketNumber, '|');
+                member.seatNumber = stoi(seatStr);
+                if(!flight->isSeatAvailable(member.seatNumber) || findTicket(member.ticketNumber, handle)) return;
+            }
+            for(auto& member : party) {
+                if(claimTicket(*flight, member.ticketNumber)) addPassenger(*flight, member);
+            }
+        } else if(op == "W") {
+            applyWaitlistEntry(ss);
+        } else if(op == "L" || op == "P") {
+            string flightNumber, idStr, seatStr, ticketNumber;
+            getline(ss, flightNumber, '|');
+            getline(ss, idStr, '|');
+            
+            Flight* flight = findFlight(flightNumber);
+            if(!flight || !waitlists[flight->slot]) return;
+            Waitlist& waitlist = *waitlists[flight->slot];
+            const WaitlistEntry* entry = waitlist.find(stoull(idStr));
+            if(!entry) return;
+            
+            if(op == "P") {
+                getline(ss, seatStr, '|');
+                getline(ss, ticketNumber, '|');
+                int seatNumber = stoi(seatStr);
+                if(flight->isSeatAvailable(seatNumber) && claimTicket(*flight, ticketNumber)) {
+                    Passenger passenger(entry->name, entry->email, entry->phone, seatNumber);
+                    passenger.ticketNumber = ticketNumber;
+                    addPassenger(*flight, passenger);
+                }
+            }
+            waitlist.remove(entry->id);
+            waitlistsDirty = true;
+        } else if(op == "C") {
+            string ticketNumber;
+            getline(ss, ticketNumber, '|');
+            
+            TicketHandle handle;
+            if(findTicket(ticketNumber, handle)) removePassenger(handle);
+        } else if(op == "A") {
+            Flight flight;
+            parseFlightHeader(ss, flight);
+            if(findFlight(flight.flightNumber)) return;
+            
+            appendFlight(flight);
+        } else if(op == "M") {
+            Flight details;
+            parseFlightHeader(ss, details);
+            
+            Flight* flight = findFlight(details.flightNumber);
+            if(flight) applyFlightDetails(*flight, details);
+        } else if(op == "D") {
+            string flightNumber;
+            getline(ss, flightNumber, '|');
+            
+            auto it = flightIndex.find(flightNumber);
+            if(it != flightIndex.end()) eraseFlight(it->second);
+        } else if(op == "S") {
+            string flightNumber, statusStr;
+            getline(ss, flightNumber, '|');
+            getline(ss, statusStr, '|');
+            
+            Flight* flight = findFlight(flightNumber);
+            if(flight) {
+                flight->status = flightStatusFromNumber(stoi(statusStr));
+                flight->dirty = true;
+                summarizeFlight(*flight);
+            }
+        } else if(op == "T") {
+            string blockEndStr;
+            getline(ss, blockEndStr, '|');
+            
+            reservedTicketSequence = max<uint64_t>(reservedTicketSequence, stoull(blockEndStr));
+        }
+    }
+    
+    // ticketBlocksOnly applies just the T records, for a schedule that did not load
+    void replayJournal(bool ticketBlocksOnly = false) {
+        ifstream journal(JOURNAL_FILE);
+        if(!journal.is_open()) return;
+        
+        string line;
+        while(getline(journal, line)) {
+            if(line.empty()) continue;
+            
+            // A record without its newline is what a crash mid-append leaves behind
+            if(journal.eof()) break;
+            if(ticketBlocksOnly && line.compare(0, 2, "T|") != 0) continue;
+            
+            try {
+                applyJournalRecord(line);
+            } catch(const exception&) {
+                continue;
+            }
+            journalRecords++;
+        }
+    }
+    
+public:
+    // flights.txt format - header line, seat line, passenger line
+    static void writeFlightText(OutputBuffer& out, const Flight& flight, const PassengerStore& store) {
+        out << formatFlightHeader(flight) << '\n';
+        
+        // Save seat data
+        for(const auto& cabin : flight.layout->cabins) {
+            for(int seatNum = cabin.firstSeat; seatNum < cabin.firstSeat + cabin.seatCount; seatNum++) {
+                out << seatNum << ","
+                    << flight.isSeatBooked(seatNum) << ","
+                    << static_cast<int>(cabin.type) << ","
+                    << cabin.basePrice << ";";
+            }
+        }
+        out << '\n';
+        
+        // Save passenger data
+        for(PassengerId id : flight.passengers) {
+            out << store.name(id) << ","
+                << store.email(id) << ","
+                << store.phone(id) << ","
+                << store.seatNumber(id) << ","
+                << store.ticketNumber(id) << ";";
+        }
+        out << '\n';
+    }
+    
+    // bookingHistory.txt format - one phone number and its tickets per line
+    static void writeHistoryText(OutputBuffer& out, const string& phone, const vector<string>& tickets) {
+        out << phone << "|";
+        for(const auto& ticketNum : tickets) {
+            out << ticketNum << ",";
+        }
+        out << '\n';
+    }
+    
+    // Printable ticket, as archived when it is issued
+    static void writeTicketText(ostream& out, const Flight& flight, const Passenger& passenger) {
+        out << "=============================================\n";
+        out << "            HAWAII JAHAJH DE TICKET          \n";
+        out << "=============================================\n\n";
+        out << "TICKET NUMBER: " << passenger.ticketNumber << "\n\n";
+        out << "PASSENGER INFORMATION:\n";
+        out << "Name: " << passenger.name << "\n";
+        out << "Phone: " << passenger.phone << "\n";
+        out << "Email: " << passenger.email << "\n\n";
+        out << "FLIGHT INFORMATION:\n";
+        out << "Flight Number: " << flight.flightNumber << "\n";
+        out << "From: " << flight.sourceName() << "\n";
+        out << "To: " << flight.destinationName() << "\n";
+        if(flight.via != NO_AIRPORT) {
+            out << "Via: " << flight.viaName() << "\n";
+        }
+        out << "Date: " << flight.date << "\n";
+        out << "Departure Time: " << flight.sourceTime << "\n";
+        out << "Arrival Time: " << flight.destinationTime << "\n";
+        out << "Seat Number: " << passenger.seatNumber << " (" << flight.getSeatType(passenger.seatNumber)
+            << ", Row " << flight.layout->seatLabel(passenger.seatNumber) << ")\n\n";
+        out << "=============================================\n";
+        out << "         THANK YOU FOR FLYING WITH US!       \n";
+        out << "=============================================\n";
+    }
+    
+    // A system that is not persistent starts empty and never touches the
+    // data files - used by the stress test
+    explicit FlightBookingSystem(bool persistent = true) :
+        nextFlightSlot(1), fareCurve(fareCurves().defaultCurve()), scheduleVersion(0),
+        holdEpoch(chrono::steady_clock::now()), holdStopping(false), holdsExpireInline(false),
+        nextWaitlistId(1), waitlistsDirty(false), nextTicketSequence(1), reservedTicketSequence(1),
+        storeGeneration(0), storeDataSize(0), storeLiveBytes(0), airportEntry(), storedAirportCount(0),
+        storeRewriteDue(false), storeUnreadable(false), persistenceStats(),
+        persistent(persistent), pendingCount(0), nextJournalSequence(1), durableSequence(1),
+        journalFailed(false), checkpointRequested(false), checkpointsDone(0), stopping(false),
+        journalFile(nullptr), journalRecords(0), durabilityPolicy(SYNC_COMMIT) {
+        if(persistent) {
+            loadData();
+            persistenceThread = thread(&FlightBookingSystem::persistenceLoop, this);
+        }
+    }
+    
+    // The worker writes what is still queued and checkpoints before it exits
+    ~FlightBookingSystem() {
+        {
+            lock_guard<mutex> holdGuard(holdMutex);
+            holdStopping = true;
+            holdWork.notify_one();
+        }
+        if(holdReaper.joinable()) holdReaper.join();
+        
+        if(!persistent) return;
+        {
+            lock_guard<mutex> guard(journalMutex);
+            stopping = true;
+            journalWork.notify_one();
+        }
+        persistenceThread.join();
+        if(journalFile) fclose(journalFile);
+    }
+    
+    void setDurabilityPolicy(DurabilityPolicy policy) {
+        durabilityPolicy = policy;
+    }
+    
+    DurabilityPolicy getDurabilityPolicy() const {
+        return durabilityPolicy;
+    }
+    
+    // False when a store exists but could not be read; only importText may run
+    bool isLoaded() const {
+        return !storeUnreadable;
+    }
+    
+    // Wait until the last mutation made by the calling thread is on disk.
+    // Returns false if writing the journal has failed since the last checkpoint.
+    bool awaitDurable() {
+        if(!persistent) return true;
+        
+        unique_lock<mutex> guard(journalMutex);
+        uint64_t sequence = (lastJournalRecord.system == this) ? lastJournalRecord.sequence : 0;
+        journalSynced.wait(guard, [&]() { return durableSequence > sequence; });
+        return !journalFailed;
+    }
+    
+    // Wait until every mutation made so far, by any thread, is on disk
+    bool flushJournal() {
+        if(!persistent) return true;
+        
+        unique_lock<mutex> guard(journalMutex);
+        uint64_t sequence = nextJournalSequence - 1;
+        journalSynced.wait(guard, [&]() { return durableSequence > sequence; });
+        return !journalFailed;
+    }
+    
+    // Write the current state to flights.txt and bookingHistory.txt
+    bool exportText() {
+        unique_lock<shared_mutex> schedule(scheduleMutex);
+        return saveTextSnapshot();
+    }
+    
+    // Render a booked ticket into the archive
+    bool issueTicket(const string& ticketNumber) {
+        string text;
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            TicketHandle handle;
+            if(!findTicket(ticketNumber, handle)) return false;
+            
+            lock_guard<mutex> guard(flightLock(handle.flight));
+            if(!findTicket(ticketNumber, handle)) return false;
+            
+            stringstream ss;
+            const Flight& flight = flights[handle.flight];
+            writeTicketText(ss, flight, passengerStore.get(flight.passengers[handle.passenger]));
+            text = ss.str();
+        }
+        return ticketArchive.append(ticketNumber, text);
+    }
+    
+    // Text of a booked ticket, read back from the archive. Tickets issued
+    // before the archive existed are rendered and archived on first use.
+    bool ticketText(const string& ticketNumber, string& text) {
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            TicketHandle handle;
+            if(!findTicket(ticketNumber, handle)) return false;
+        }
+        if(ticketArchive.read(ticketNumber, text)) return true;
+        
+        return issueTicket(ticketNumber) && ticketArchive.read(ticketNumber, text);
+    }
+    
+    // Every booked ticket, rendered straight from the booking data in one
+    // pass over the flights
+    size_t exportTickets(ostream& out) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        size_t exported = 0;
+        for(size_t flightPos = 0; flightPos < flights.size(); flightPos++) {
+            lock_guard<mutex> guard(flightLock(flightPos));
+            for(PassengerId id : flights[flightPos].passengers) {
+                writeTicketText(out, flights[flightPos], passengerStore.get(id));
+                out << '\n';
+                exported++;
+            }
+        }
+        return exported;
+    }
+    
+    static const vector<ReportColumn>& manifestColumns() {
+        static const vector<ReportColumn> columns = {
+            {"Flight#", "flight", 9}, {"Date", "date", 12}, {"Seat", "seat", 6}, {"Class", "class", 17},
+            {"Name", "name", 20}, {"Email", "email", 26}, {"Phone", "phone", 13}, {"Ticket#", "ticket", 16}
+        };
+        return columns;
+    }
+    
+    static const vector<ReportColumn>& flightReportColumns() {
+        static const vector<ReportColumn> columns = {
+            {"Flight#", "flight", 9}, {"Source", "source", 12}, {"Destination", "destination", 13},
+            {"Date", "date", 12}, {"Dep", "departs", 6}, {"Arr", "arrives", 6}, {"Via", "via", 12},
+            {"Stops", "stops", 6}, {"Price", "basePrice", 10}, {"Status", "status", 9},
+            {"Layout", "layout", 8}, {"Seats", "seats", 6}, {"Booked", "booked", 6}
+        };
+        return columns;
+    }
+    
+    // Passenger manifest of one flight, or of every flight when flightNumber
+    // is empty, one row per booking. Returns false for an unknown flight.
+    bool writeManifestReport(ReportWriter& report, const string& flightNumber) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        size_t first = 0, last = flights.size();
+        if(!flightNumber.empty()) {
+            Flight* flight = findFlight(flightNumber);
+            if(!flight) return false;
+            first = flight - flights.data();
+            last = first + 1;
+        }
+        
+        for(size_t flightPos = first; flightPos < last; flightPos++) {
+            lock_guard<mutex> guard(flightLock(flightPos));
+            const Flight& flight = flights[flightPos];
+            if(flight.passengers.empty()) continue;
+            
+            string date = flight.date.toString();
+            for(PassengerId id : flight.passengers) {
+                int seatNum = passengerStore.seatNumber(id);
+                report.field(flight.flightNumber).field(date)
+                      .field(static_cast<long long>(seatNum)).field(flight.getSeatType(seatNum))
+                      .field(passengerStore.name(id)).field(passengerStore.email(id))
+                      .field(passengerStore.phone(id)).field(passengerStore.ticketNumber(id));
+                report.endRow();
+            }
+        }
+        return true;
+    }
+    
+    // Every flight in schedule order with its seat counts
+    void writeFlightReport(ReportWriter& report) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        for(size_t flightPos = 0; flightPos < flights.size(); flightPos++) {
+            lock_guard<mutex> guard(flightLock(flightPos));
+            const Flight& flight = flights[flightPos];
+            report.field(flight.flightNumber).field(flight.sourceName()).field(flight.destinationName())
+                  .field(flight.date.toString()).field(flight.sourceTime.toString())
+                  .field(flight.destinationTime.toString()).field(flight.viaName())
+                  .field(static_cast<long long>(flight.stops)).field(flight.basePrice, 2)
+                  .field(flightStatusName(flight.status)).field(flight.layout->id)
+                  .field(static_cast<long long>(flight.seatCount))
+                  .field(static_cast<long long>(flight.bookedCount));
+            report.endRow();
+        }
+    }
+    
+    // Replace the current state with flights.txt. Booking history is rebuilt
+    // from the passengers, so bookingHistory.txt is not read.
+    void importText() {
+        {
+            unique_lock<shared_mutex> schedule(scheduleMutex);
+            storeUnreadable = false;
+            clearFlights();
+            loadTextSnapshot();
+            rebuildIndexes();
+            nextTicketSequence = max(nextTicketSequence.load(), reservedTicketSequence.load());
+            storeRewriteDue = true;
+        }
+        checkpoint();
+    }
+    
+    // Core operations - shared by the menus and the command stream, no prompts
+    
+    // Checks the customer's bookings rather than the flight's passengers, so
+    // the cost does not grow with the size of the flight
+    bool hasDuplicateBooking(const Flight& flight, const string& name, const string& phone) const {
+        bool duplicate = false;
+        customerIndex.visit(phone, [&](const vector<PassengerId>& bookings) {
+            for(PassengerId id : bookings) {
+                if(passengerStore.flightSlot(id) == flight.slot && passengerStore.name(id) == name) {
+                    duplicate = true;
+                    break;
+                }
+            }
+        });
+        return duplicate;
+    }
+    
+    // Safe to call from many threads at once. The seat check and the seat
+    // claim happen under the same flight lock, so two agents can never both
+    // get the seat. price is what the seat cost at the moment it was booked.
+    BookingResult bookSeat(const string& flightNumber, int seatNumber, const string& name, const string& email,
+                           const string& phone, Passenger& booked, double& price) {
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            Flight* flight = findFlight(flightNumber);
+            if(!flight) return FLIGHT_NOT_FOUND;
+            
+            lock_guard<mutex> guard(flightLock(flight - flights.data()));
+            BookingResult result = checkSeat(*flight, seatNumber);
+            if(result != BOOKED) return result;
+            if(hasDuplicateBooking(*flight, name, phone)) return DUPLICATE_BOOKING;
+            
+            issueBooking(*flight, seatNumber, name, email, phone, booked, price);
+        }
+        commitMutation();
+        return BOOKED;
+    }
+    
+    // Put a short hold on a seat while its passenger's details are taken.
+    // Nobody else can hold or book the seat until the hold is used by
+    // bookHeldSeat, released, or expires after ttlSeconds. Returns HELD
+    // with the hold's token.
+    BookingResult holdSeat(const string& flightNumber, int seatNumber, int ttlSeconds, uint64_t& token) {
+        expireHolds();
+        
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        Flight* flight = findFlight(flightNumber);
+        if(!flight) return FLIGHT_NOT_FOUND;
+        
+        lock_guard<mutex> guard(flightLock(flight - flights.data()));
+        BookingResult result = checkSeat(*flight, seatNumber);
+        if(result != BOOKED) return result;
+        
+        flight->setSeatHeld(seatNumber, true);
+        lock_guard<mutex> holdGuard(holdMutex);
+        uint64_t ttlTicks = (static_cast<uint64_t>(max(ttlSeconds, 0)) * 1000 + HOLD_TICK_MS - 1) / HOLD_TICK_MS;
+        token = holdWheel.schedule(holdTick() + ttlTicks, holdPayload(flight->slot, seatNumber));
+        if(holdsExpireInline) return HELD;
+        if(!holdReaper.joinable()) {
+            holdReaper = thread(&FlightBookingSystem::holdReaperLoop, this);
+        } else if(holdWheel.size() == 1) {
+            holdWork.notify_one();
+        }
+        return HELD;
+    }
+    
+    // Give up a hold before it expires. False if it already expired or was used.
+    bool releaseHold(uint64_t token) {
+        string promotedTicket;
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            size_t flightPos;
+            int seatNumber;
+            if(!findHold(token, flightPos, seatNumber)) return false;
+            
+            lock_guard<mutex> guard(flightLock(flightPos));
+            {
+                lock_guard<mutex> holdGuard(holdMutex);
+                if(!holdWheel.cancel(token)) return false;
+            }
+            flights[flightPos].setSeatHeld(seatNumber, false);
+            if(!promoteWaitlisted(flights[flightPos], seatNumber, promotedTicket)) return true;
+        }
+        commitMutation();
+        return true;
+    }
+    
+    // Book the seat a hold is on. The hold is used up only if the booking goes ahead.
+    BookingResult bookHeldSeat(uint64_t token, const string& name, const string& email, const string& phone,
+                               Passenger& booked, double& price) {
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            size_t flightPos;
+            int seatNumber;
+            if(!findHold(token, flightPos, seatNumber)) return HOLD_EXPIRED;
+            
+            Flight& flight = flights[flightPos];
+            lock_guard<mutex> guard(flightLock(flightPos));
+            if(flight.status == CANCELED) return FLIGHT_CANCELED;
+            if(hasDuplicateBooking(flight, name, phone)) return DUPLICATE_BOOKING;
+            {
+                // A hold past its deadline that expireHolds has not reached yet
+                // is expired all the same; expireHolds clears its seat
+                lock_guard<mutex> holdGuard(holdMutex);
+                uint64_t payload, deadline;
+                if(!holdWheel.find(token, payload, deadline) || deadline <= holdTick()) return HOLD_EXPIRED;
+                holdWheel.cancel(token);
+            }
+            flight.setSeatHeld(seatNumber, false);
+            
+            issueBooking(flight, seatNumber, name, email, phone, booked, price);
+        }
+        commitMutation();
+        return BOOKED;
+    }
+    
+    // Seat a whole party on one flight, or nobody. Seats come from a single
+    // cabin: the first run of adjacent free seats long enough for everyone,
+    // else the cabin's free seats nearest the front. The group goes to the
+    // journal as one record, so a crash keeps all of it or none.
+    BookingResult bookGroup(GroupBooking& group) {
+        int size = static_cast<int>(group.party.size());
+        if(size < 1 || size > MAX_GROUP_SIZE) return INVALID_GROUP;
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            Flight* flight = findFlight(group.flightNumber);
+            if(!flight) return FLIGHT_NOT_FOUND;
+            
+            lock_guard<mutex> guard(flightLock(flight - flights.data()));
+            if(flight->status == CANCELED) return FLIGHT_CANCELED;
+            for(int i = 0; i < size; i++) {
+                const Passenger& member = group.party[i];
+                if(hasDuplicateBooking(*flight, member.name, member.phone)) return DUPLICATE_BOOKING;
+                for(int j = 0; j < i; j++) {
+                    if(group.party[j].name == member.name && group.party[j].phone == member.phone) return DUPLICATE_BOOKING;
+                }
+            }
+            
+            // Cabins from economy forward, or just the class asked for
+            vector<const Cabin*> cabins;
+            for(const auto& cabin : flight->layout->cabins) {
+                if(group.anyClass || cabin.type == group.seatClass) cabins.push_back(&cabin);
+            }
+            stable_sort(cabins.begin(), cabins.end(), [](const Cabin* a, const Cabin* b) {
+                return seatClassRank(a->type) > seatClassRank(b->type);
+            });
+            
+            vector<int> seats;
+            group.adjacent = false;
+            for(const Cabin* cabin : cabins) {
+                int first = flight->findFreeRun(cabin->firstSeat, cabin->seatCount, size);
+                if(first) {
+                    for(int i = 0; i < size; i++) seats.push_back(first + i);
+                    group.adjacent = true;
+                    break;
+                }
+            }
+            for(size_t c = 0; seats.empty() && c < cabins.size(); c++) {
+                if(flight->collectFreeSeats(cabins[c]->firstSeat, cabins[c]->seatCount, size, seats) < size) seats.clear();
+            }
+            if(seats.empty()) return NOT_ENOUGH_SEATS;
+            
+            group.fares.assign(size, 0);
+            group.totalFare = 0;
+            for(int i = 0; i < size; i++) {
+                Passenger& member = group.party[i];
+                group.fares[i] = fareCurve->quoteSeat(*flight, seats[i]);
+                group.totalFare += group.fares[i];
+                member.seatNumber = seats[i];
+                do {
+                    member.ticketNumber = allocateTicketNumber(*flight);
+                } while(!claimTicket(*flight, member.ticketNumber));
+                addPassenger(*flight, member);
+            }
+            journalGroup(*flight, group.party);
+        }
+        commitMutation();
+        return BOOKED;
+    }
+    
+    // Join the waitlist of a class with no seat left to book. The passenger's
+    // loyalty tier comes from the bookings they hold; position is their place
+    // in line. Returns WAITLISTED.
+    BookingResult joinWaitlist(const string& flightNumber, SeatClass seatClass, const string& name, const string& email,
+                               const string& phone, WaitlistEntry& entry, size_t& position) {
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            Flight* flight = findFlight(flightNumber);
+            if(!flight) return FLIGHT_NOT_FOUND;
+            
+            lock_guard<mutex> guard(flightLock(flight - flights.data()));
+            if(flight->status == CANCELED) return FLIGHT_CANCELED;
+            
+            // A layout may split one class over several cabins; any free seat
+            // in any of them means there is nothing to wait for
+            bool offered = false;
+            for(const auto& cabin : flight->layout->cabins) {
+                if(cabin.type != seatClass) continue;
+                offered = true;
+                if(flight->findFreeRun(cabin.firstSeat, cabin.seatCount, 1)) return SEATS_AVAILABLE;
+            }
+            if(!offered) return CLASS_NOT_OFFERED;
+            
+            Waitlist& waitlist = flightWaitlist(*flight);
+            if(hasDuplicateBooking(*flight, name, phone) || waitlist.contains(name, phone)) return DUPLICATE_BOOKING;
+            
+            size_t bookings = 0;
+            customerIndex.visit(phone, [&](const vector<PassengerId>& held) { bookings = held.size(); });
+            entry.id = nextWaitlistId++;
+            entry.tier = loyaltyTierFor(bookings);
+            entry.seatClass = seatClass;
+            entry.name = name;
+            entry.email = email;
+            entry.phone = phone;
+            waitlist.add(entry);
+            position = waitlist.lineLength(seatClass, entry.tier);
+            waitlistsDirty = true;
+            journalJoinWaitlist(*flight, entry);
+        }
+        commitMutation();
+        return WAITLISTED;
+    }
+    
+    bool leaveWaitlist(const string& flightNumber, uint64_t id) {
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            Flight* flight = findFlight(flightNumber);
+            if(!flight) return false;
+            
+            lock_guard<mutex> guard(flightLock(flight - flights.data()));
+            if(!flightWaitlist(*flight).remove(id)) return false;
+            waitlistsDirty = true;
+            journalLeaveWaitlist(*flight, id);
+        }
+        commitMutation();
+        return true;
+    }
+    
+    // Everyone waiting on the flight, by class and then in promotion order
+    bool waitlistEntries(const string& flightNumber, vector<WaitlistEntry>& entries) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        Flight* flight = findFlight(flightNumber);
+        if(!flight) return false;
+        
+        lock_guard<mutex> guard(flightLock(flight - flights.data()));
+        entries = flightWaitlist(*flight).ordered();
+        return true;
+    }
+    
+    size_t activeHolds() {
+        lock_guard<mutex> holdGuard(holdMutex);
+        return holdWheel.size();
+    }
+    
+    bool cancelBooking(const string& ticketNumber) {
+        string promotedTicket;
+        return cancelBooking(ticketNumber, promotedTicket);
+    }
+    
+    // The freed seat goes straight to the flight's waitlist, in the same
+    // operation; promotedTicket is the ticket it was booked under, if any.
+    bool cancelBooking(const string& ticketNumber, string& promotedTicket) {
+        promotedTicket.clear();
+        {
+            shared_lock<shared_mutex> schedule(scheduleMutex);
+            TicketHandle handle;
+            size_t flightPos;
+            if(!ticketFlight(ticketNumber, flightPos)) {
+                if(!findTicket(ticketNumber, handle)) return false;
+                flightPos = handle.flight;
+            }
+            
+            // A ticket only moves to another flight under the exclusive schedule
+            // lock, but a cancellation on the same flight may move it to another
+            // passenger slot, so it is looked up again under the flight lock
+            lock_guard<mutex> guard(flightLock(flightPos));
+            if(!findTicket(ticketNumber, handle) || handle.flight != flightPos) return false;
+            
+            int seatNumber = passengerStore.seatNumber(flights[flightPos].passengers[handle.passenger]);
+            removePassenger(handle);
+            journalCancel(ticketNumber);
+            promoteWaitlisted(flights[flightPos], seatNumber, promotedTicket);
+        }
+        commitMutation();
+        return true;
+    }
+    
+    // Flights matching the query, in departure order. The returned pointers
+    // stay valid until the next schedule change.
+    vector<Flight*> searchSchedule(const ScheduleQuery& query) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        return findSchedule(query);
+    }
+    
+    // searchSchedule() for callers already holding the schedule lock
+    vector<Flight*> findSchedule(const ScheduleQuery& query) {
+        vector<Flight*> results;
+        
+        // Filters are compared as airport IDs; a name no flight uses matches nothing
+        AirportId sourceId = NO_AIRPORT, destinationId = NO_AIRPORT;
+        if((!query.source.empty() && !airports().find(query.source, sourceId)) ||
+           (!query.destination.empty() && !airports().find(query.destination, destinationId))) {
+            return results;
+        }
+        
+        // With both ends of the route given only that route's flights are candidates,
+        // with a date range only the flights departing inside it
+        vector<Flight*> candidates;
+        bool sorted = false;
+        if(!query.source.empty() && !query.destination.empty()) {
+            for(size_t flightPos : findRoute(sourceId, destinationId)) {
+                candidates.push_back(&flights[flightPos]);
+            }
+        } else if(query.fromDate.valid() || query.toDate.valid()) {
+            int64_t first = query.fromDate.valid() ? static_cast<int64_t>(query.fromDate.day) * 1440 : INT64_MIN;
+            int64_t last = query.toDate.valid() ? static_cast<int64_t>(query.toDate.day) * 1440 + 1439 : INT64_MAX;
+            for(auto it = departureIndex.lower_bound(make_pair(first, size_t(0)));
+                it != departureIndex.end() && it->first <= last; ++it) {
+                candidates.push_back(&flights[it->second]);
+            }
+            sorted = true;
+        } else {
+            for(auto& flight : flights) {
+                candidates.push_back(&flight);
+            }
+        }
+        
+        for(Flight* flight : candidates) {
+            bool matchesSource = query.source.empty() || flight->source == sourceId;
+            bool matchesDest = query.destination.empty() || flight->destination == destinationId;
+            bool matchesPrice = query.maxPrice < 0 || flight->basePrice <= query.maxPrice;
+            
+            if(matchesSource && matchesDest && matchesPrice &&
+               query.matchesDate(flight->date) && query.matchesTime(flight->sourceTime)) {
+                results.push_back(flight);
+            }
+        }
+        
+        if(!sorted) {
+            // Ties keep schedule order, as in the departure index
+            sort(results.begin(), results.end(), [](const Flight* a, const Flight* b) {
+                int64_t keyA = a->departureKey(), keyB = b->departureKey();
+                return keyA != keyB ? keyA < keyB : a < b;
+            });
+        }
+        return results;
+    }
+    
+    // Empty filters match everything, a negative maxPrice means no limit.
+    // A date that does not parse as DD/MM/YYYY matches no flight.
+    vector<Flight*> searchFlights(const string& source, const string& destination,
+                                  const string& date, double maxPrice) {
+        ScheduleQuery query;
+        query.source = source;
+        query.destination = destination;
+        query.maxPrice = maxPrice;
+        if(!date.empty()) {
+            if(!FlightDate::parse(date, query.fromDate)) return vector<Flight*>();
+            query.toDate = query.fromDate;
+        }
+        return searchSchedule(query);
+    }
+    
+    // Fares of one flight from its occupancy counters. The caller holds the
+    // flight's lock or is the only thread.
+    FlightQuote quoteFlight(const Flight& flight) const {
+        FlightQuote quote = {};
+        quote.flight = &flight;
+        fareCurve->quoteCabins(flight, quote.cabinFares);
+        for(size_t i = 0; i < flight.layout->cabins.size(); i++) {
+            quote.cabinSeatsLeft[i] = flight.layout->cabins[i].seatCount - flight.cabinBooked[i];
+            if(quote.cabinSeatsLeft[i] > 0 && flight.status != CANCELED &&
+               (quote.lowestFare == 0 || quote.cabinFares[i] < quote.lowestFare)) {
+                quote.lowestFare = quote.cabinFares[i];
+            }
+        }
+        return quote;
+    }
+    
+    // Seats left and lowest fare on a route for each day from..to, read from
+    // the route's calendar - no flight is looked at, so a month costs the
+    // same however many flights it has. Days without flights have none left.
+    vector<RouteDay> routeAvailability(const string& source, const string& destination, FlightDate from, FlightDate to) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        vector<RouteDay> days;
+        AirportId sourceId, destinationId;
+        if(!from.valid() || !to.valid() || to.day < from.day) return days;
+        days.reserve(to.day - from.day + 1);
+        
+        auto calendar = routeCalendars.end();
+        if(airports().find(source, sourceId) && airports().find(destination, destinationId)) {
+            calendar = routeCalendars.find(routeKey(sourceId, destinationId));
+        }
+        if(calendar == routeCalendars.end()) {
+            for(int32_t d = from.day; d <= to.day; d++) days.push_back(RouteDay{FlightDate(d), 0, 0, 0});
+            return days;
+        }
+        
+        lock_guard<mutex> guard(calendar->second->lock);
+        calendar->second->copyDays(from, to, days);
+        return days;
+    }
+    
+    // A calendar month of routeAvailability()
+    vector<RouteDay> routeMonth(const string& source, const string& destination, int year, int month) {
+        if(month < 1 || month > 12) return vector<RouteDay>();
+        return routeAvailability(source, destination, FlightDate::fromCivil(year, month, 1),
+                                 FlightDate::fromCivil(year, month, FlightDate::daysInMonth(year, month)));
+    }
+    
+    // Current fares of every flight matching the query, e.g. all flights on
+    // a route, in departure order and under one schedule lock
+    vector<FlightQuote> quoteSchedule(const ScheduleQuery& query) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        vector<FlightQuote> quotes;
+        for(Flight* flight : findSchedule(query)) {
+            lock_guard<mutex> guard(flightLock(flight - flights.data()));
+            quotes.push_back(quoteFlight(*flight));
+        }
+        return quotes;
+    }
+    
+    // Current fare and state of every seat on a flight
+    bool quoteSeatMap(const string& flightNumber, SeatMapQuote& quote) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        Flight* flight = findFlight(flightNumber);
+        if(!flight) return false;
+        
+        lock_guard<mutex> guard(flightLock(flight - flights.data()));
+        quote.layout = flight->layout;
+        fareCurve->quoteSeats(*flight, quote.fares);
+        quote.states.assign(flight->seatCount + 1, SEAT_SOLD);
+        for(int seatNum = 1; seatNum <= flight->seatCount; seatNum++) {
+            if(flight->isSeatBooked(seatNum)) continue;
+            quote.states[seatNum] = flight->isSeatHeld(seatNum) ? SEAT_HELD : SEAT_FREE;
+        }
+        return true;
+    }
+    
+    // The route graph for the current schedule. Callers hold the schedule
+    // lock shared, so the version cannot move while they use it.
+    const ConnectionGraph& connectionGraph() {
+        lock_guard<mutex> guard(routeGraphMutex);
+        if(routeGraph.version != scheduleVersion) {
+            routeGraph.build(flights, airports().size(), scheduleVersion);
+        }
+        return routeGraph;
+    }
+    
+    // Top itineraries from one airport to another over up to maxLegs flights,
+    // direct flights included. Each connection leaves at least the minimum
+    // connection time of its airport and at most the longest layover, never
+    // revisits an airport, and only uses flights with a seat left.
+    //
+    // A best-first search over partial itineraries, ordered by arrival or by
+    // total fare with the other as tie-break. Extending an itinerary never
+    // improves either, so complete ones come off the queue best first, and a
+    // flight needs to end at most limit partial itineraries - a worse prefix
+    // to it can only give a worse itinerary than the ones already kept.
+    // Airports that cannot reach the destination in the legs left are skipped.
+    vector<Itinerary> searchConnections(const ConnectionQuery& query) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        vector<Itinerary> results;
+        
+        AirportId sourceId, destinationId;
+        if(!airports().find(query.source, sourceId) || !airports().find(query.destination, destinationId) ||
+           sourceId == destinationId || query.limit == 0 || query.maxLegs < 1) {
+            return results;
+        }
+        
+        const ConnectionGraph& graph = connectionGraph();
+        if(sourceId >= graph.inbound.size() || destinationId >= graph.inbound.size()) return results;
+        vector<int> hops = graph.hopsTo(destinationId, query.maxLegs);
+        if(hops[sourceId] == INT_MAX) return results;
+        
+        // Lowest bookable fare of each flight reached, read once under its
+        // flight lock - negative when it is canceled or full
+        unordered_map<uint32_t, double> legFares;
+        auto legFare = [&](uint32_t leg) {
+            auto it = legFares.find(leg);
+            if(it != legFares.end()) return it->second;
+            
+            size_t flightPos = graph.legs[leg].flightPos;
+            lock_guard<mutex> guard(flightLock(flightPos));
+            double fare = quoteFlight(flights[flightPos]).lowestFare;
+            return legFares[leg] = (fare > 0) ? fare : -1.0;
+        };
+        
+        struct Label {
+            uint32_t leg;
+            int32_t parent; // label of the previous flight, -1 for the first
+            int legCount;
+            double fare;
+        };
+        struct QueueEntry {
+            double key;
+            double tieBreak;
+            int32_t label;
+            bool operator>(const QueueEntry& other) const {
+                if(key != other.key) return key > other.key;
+                if(tieBreak != other.tieBreak) return tieBreak > other.tieBreak;
+                return label > other.label;
+            }
+        };
+        vector<Label> labels;
+        priority_queue<QueueEntry, vector<QueueEntry>, greater<QueueEntry>> queue;
+        
+        auto push = [&](uint32_t leg, int32_t parent) {
+            const ConnectionGraph::Leg& next = graph.legs[leg];
+            int legCount = (parent < 0) ? 1 : labels[parent].legCount + 1;
+            if(hops[next.destination] > query.maxLegs - legCount || next.destination == sourceId) return;
+            for(int32_t label = parent; label >= 0; label = labels[label].parent) {
+                if(graph.legs[labels[label].leg].destination == next.destination) return;
+            }
+            
+            double fare = legFare(leg);
+            if(fare < 0) return;
+            
+            Label label = { leg, parent, legCount, (parent < 0 ? 0 : labels[parent].fare) + fare };
+            labels.push_back(label);
+            double arrives = static_cast<double>(next.arrives);
+            int32_t id = static_cast<int32_t>(labels.size() - 1);
+            queue.push(query.order == LOWEST_FARE ? QueueEntry{label.fare, arrives, id}
+                                                  : QueueEntry{arrives, label.fare, id});
+        };
+        
+        int64_t first = query.fromDate.valid() ? static_cast<int64_t>(query.fromDate.day) * 1440 : INT64_MIN;
+        int64_t last = query.toDate.valid() ? static_cast<int64_t>(query.toDate.day) * 1440 + 1439 : INT64_MAX;
+        pair<uint32_t, uint32_t> origins = graph.departures(sourceId, first, last);
+        for(uint32_t leg = origins.first; leg < origins.second; leg++) push(leg, -1);
+        
+        // Times each flight has ended a partial itinerary taken off the queue
+        unordered_map<uint32_t, size_t> expanded;
+        while(!queue.empty() && results.size() < query.limit) {
+            int32_t id = queue.top().label;
+            queue.pop();
+            Label label = labels[id];
+            size_t& times = expanded[label.leg];
+            if(times == query.limit) continue;
+            times++;
+            
+            const ConnectionGraph::Leg& leg = graph.legs[label.leg];
+            if(leg.destination == destinationId) {
+                Itinerary itinerary;
+                itinerary.totalFare = label.fare;
+                itinerary.arrives = leg.arrives;
+                for(int32_t step = id; step >= 0; step = labels[step].parent) {
+                    size_t flightPos = graph.legs[labels[step].leg].flightPos;
+                    lock_guard<mutex> guard(flightLock(flightPos));
+                    itinerary.legs.push_back(quoteFlight(flights[flightPos]));
+                    itinerary.departs = graph.legs[labels[step].leg].departs;
+                }
+                reverse(itinerary.legs.begin(), itinerary.legs.end());
+                results.push_back(move(itinerary));
+                continue;
+            }
+            
+            if(label.legCount == query.maxLegs) continue;
+            int64_t ready = leg.arrives + connectionRules.minimumAt(leg.destination);
+            pair<uint32_t, uint32_t> onward = graph.departures(leg.destination, ready, leg.arrives + connectionRules.maxLayover);
+            for(uint32_t next = onward.first; next < onward.second; next++) {
+                auto seen = expanded.find(next);
+                if(seen == expanded.end() || seen->second < query.limit) push(next, id);
+            }
+        }
+        return results;
+    }
+    
+    ConnectionRules activeConnectionRules() {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        return connectionRules;
+    }
+    
+    // Apply one rule as in connections.txt, e.g. Delhi|75 or DEFAULT|45|1440.
+    // Returns false if it does not parse.
+    bool setConnectionRule(const string& rule) {
+        unique_lock<shared_mutex> schedule(scheduleMutex);
+        if(!connectionRules.apply(rule)) return false;
+        
+        if(persistent && !connectionRules.saveFile(CONNECTION_FILE)) {
+            cerr << "Error saving connection rules!" << endl;
         }
+        return true;
     }
     
-    double getSeatPrice(int seatNum) {
-        // Dynamic pricing - increases as more seats get filled
-        double occupancyRate = getOccupancyRate();
-        double priceFactor = 1.0 + (occupancyRate * 0.5); // Up to 50% price increase
+    const FareCurve& activeFareCurve() {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        return *fareCurve;
+    }
+    
+    // Price seats with the named curve from now on. A definition as in
+    // fares.txt registers a new curve first. Returns null for an unknown ID
+    // or a definition that does not parse or reuses an ID.
+    const FareCurve* selectFareCurve(const string& definition) {
+        unique_lock<shared_mutex> schedule(scheduleMutex);
+        const FareCurve* curve = (definition.find('|') == string::npos) ? fareCurves().find(definition)
+                                                                        : fareCurves().define(definition);
+        if(!curve) return nullptr;
         
-        for(auto& seat : seats) {
-            if(seat.seatNumber == seatNum) {
-                return seat.basePrice * priceFactor;
-            }
+        fareCurve = curve;
+        for(const auto& flight : flights) summarizeFlight(flight);
+        if(persistent && !fareCurves().saveFile(FARE_FILE, *fareCurve)) {
+            cerr << "Error saving fare curves!" << endl;
         }
-        return basePrice;
+        return curve;
     }
     
-    double getOccupancyRate() {
-        int booked = 0;
-        for(const auto& seat : seats) {
-            if(seat.isBooked) booked++;
+    bool addNewFlight(const Flight& flight) {
+        {
+            unique_lock<shared_mutex> schedule(scheduleMutex);
+            if(findFlight(flight.flightNumber)) return false;
+            
+            // New flights always get a fresh slot
+            Flight added = flight;
+            added.slot = 0;
+            appendFlight(added);
+            journalAddFlight(flights.back());
         }
-        return static_cast<double>(booked) / seats.size();
+        commitMutation();
+        return true;
     }
     
-    void markSeatBooked(int seatNum) {
-        for(auto& seat : seats) {
-            if(seat.seatNumber == seatNum) {
-                seat.isBooked = true;
-                break;
-            }
+    // details carries the flight number and the new schedule fields
+    bool updateFlightDetails(const Flight& details) {
+        {
+            unique_lock<shared_mutex> schedule(scheduleMutex);
+            Flight* flight = findFlight(details.flightNumber);
+            if(!flight) return false;
+            
+            applyFlightDetails(*flight, details);
+            journalModifyFlight(*flight);
         }
+        commitMutation();
+        return true;
     }
     
-    void markSeatAvailable(int seatNum) {
-        for(auto& seat : seats) {
-            if(seat.seatNumber == seatNum) {
-                seat.isBooked = false;
-                break;
-            }
+    bool removeFlight(const string& flightNumber) {
+        {
+            unique_lock<shared_mutex> schedule(scheduleMutex);
+            auto it = flightIndex.find(flightNumber);
+            if(it == flightIndex.end()) return false;
+            
+            eraseFlight(it->second);
+            journalDeleteFlight(flightNumber);
         }
+        commitMutation();
+        return true;
     }
     
-    bool isSeatAvailable(int seatNum) const {
-        for(const auto& seat : seats) {
-            if(seat.seatNumber == seatNum) {
-                return !seat.isBooked;
-            }
+    bool setFlightStatus(const string& flightNumber, FlightStatus status) {
+        {
+            unique_lock<shared_mutex> schedule(scheduleMutex);
+            Flight* flight = findFlight(flightNumber);
+            if(!flight) return false;
+            
+            flight->status = status;
+            flight->dirty = true;
+            summarizeFlight(*flight);
+            journalStatus(*flight);
         }
-        return false;
+        commitMutation();
+        return true;
     }
     
-    string getSeatType(int seatNum) const {
-        for(const auto& seat : seats) {
-            if(seat.seatNumber == seatNum) {
-                return (seat.type == ECONOMY) ? "Economy" : "Business";
+    // Walks only the customer's own bookings - each entry leads straight to
+    // its passenger and, through the passenger's flight slot, to its flight
+    vector<BookingHistoryEntry> bookingHistoryOf(const string& phone) {
+        shared_lock<shared_mutex> schedule(scheduleMutex);
+        vector<BookingHistoryEntry> entries;
+        customerIndex.visit(phone, [&](const vector<PassengerId>& bookings) {
+            entries.reserve(bookings.size());
+            for(PassengerId id : bookings) {
+                uint32_t slot = passengerStore.flightSlot(id);
+                if(slot >= slotIndex.size() || slotIndex[slot] == NO_FLIGHT) continue;
+                
+                const Flight& flight = flights[slotIndex[slot]];
+                entries.push_back(BookingHistoryEntry{string(passengerStore.ticketNumber(id)), flight.flightNumber,
+                                                      flight.sourceName(), flight.destinationName(),
+                                                      flight.date, flight.status});
             }
+        });
+        return entries;
+    }
+    
+    // Write a snapshot right away, even for a system that is not persistent.
+    // Only what changed since the last one is written unless full is set.
+    bool saveSnapshot(bool full = false) {
+        lock_guard<mutex> store(storeMutex);
+        PendingSave save;
+        {
+            unique_lock<shared_mutex> schedule(scheduleMutex);
+            prepareSave(full, save);
         }
-        return "Unknown";
+        return writeSave(save);
     }
-};
-
-// Flight Booking System Class
-class FlightBookingSystem {
-private:
-    vector<Flight> flights;
-    map<string, vector<string>> bookingHistory; // phone -> ticketNumbers
     
-    void saveData() {
-        ofstream flightFile("flights.txt");
-        if(!flightFile.is_open()) {
-            cout << "Error saving flight data!" << endl;
-            return;
+    PersistenceStats persistenceStatistics() {
+        unique_lock<shared_mutex> schedule(scheduleMutex);
+        lock_guard<mutex> guard(journalMutex);
+        return persistenceStats;
+    }
+    
+    // Remove every data file this system reads or writes in the current directory
+    static void removeDataFiles() {
+        MappedFile indexFile;
+        StoreHeader header;
+        if(indexFile.open(STORE_INDEX_FILE) && BlobReader{indexFile.begin(), indexFile.size()}.read(0, header) &&
+           memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) == 0) {
+            remove(storeDataFile(header.generation).c_str());
         }
+        indexFile.close();
+        remove(STORE_INDEX_FILE);
+        remove(JOURNAL_FILE);
+        remove(LAYOUT_FILE);
+        remove(FARE_FILE);
+        remove(CONNECTION_FILE);
+        remove(WAITLIST_FILE);
+        remove("flights.txt");
+        remove("bookingHistory.txt");
+    }
+    
+    // Consistency check for the stress test - every booked seat belongs to
+    // exactly one passenger and every ticket indexes its passenger.
+    // Returns the number of problems found, each described on out.
+    size_t verifyInventory(ostream& out) {
+        unique_lock<shared_mutex> schedule(scheduleMutex);
+        size_t problems = 0;
+        size_t passengerCount = 0;
         
-        for(const auto& flight : flights) {
-            flightFile << flight.flightNumber << "|"
-                       << flight.source << "|"
-                       << flight.destination << "|"
-                       << flight.sourceTime << "|"
-                       << flight.destinationTime << "|"
-                       << flight.date << "|"
-                       << flight.basePrice << "|"
-                       << flight.via << "|"
-                       << flight.stops << "|"
-                       << static_cast<int>(flight.status) << endl;
-                       
-            // Save seat data
-            for(const auto& seat : flight.seats) {
-                flightFile << seat.seatNumber << ","
-                           << seat.isBooked << ","
-                           << static_cast<int>(seat.type) << ","
-                           << seat.basePrice << ";";
-            }
-            flightFile << endl;
-            
-            // Save passenger data
-            for(const auto& passenger : flight.passengers) {
-                flightFile << passenger.name << ","
-                           << passenger.email << ","
-                           << passenger.phone << ","
-                           << passenger.seatNumber << ","
-                           << passenger.ticketNumber << ";";
-            }
-            flightFile << endl;
+        for(size_t flightPos = 0; flightPos < flights.size(); flightPos++) {
+            const Flight& flight = flights[flightPos];
+            vector<int> holders(flight.seatCount + 1, 0);
+            
+            for(size_t i = 0; i < flight.passengers.size(); i++) {
+                Passenger passenger = passengerStore.get(flight.passengers[i]);
+                if(passenger.seatNumber < 1 || passenger.seatNumber > flight.seatCount) {
+                    out << "Flight " << flight.flightNumber << ": ticket " << passenger.ticketNumber << " has invalid seat\n";
+                    problems++;
+                    continue;
+                }
+                if(++holders[passenger.seatNumber] == 2) {
+                    out << "Flight " << flight.flightNumber << ": seat " << passenger.seatNumber << " double-booked\n";
+                    problems++;
+                }
+                if(!flight.isSeatBooked(passenger.seatNumber)) {
+                    out << "Flight " << flight.flightNumber << ": seat " << passenger.seatNumber << " not marked booked\n";
+                    problems++;
+                }
+                
+                TicketHandle handle;
+                if(!findTicket(passenger.ticketNumber, handle) || handle.flight != flightPos || handle.passenger != i) {
+                    out << "Ticket " << passenger.ticketNumber << " is not indexed to its passenger\n";
+                    problems++;
+                }
+            }
+            
+            if(flight.bookedCount != static_cast<int>(flight.passengers.size()) ||
+               flight.countBookedSeats(1, flight.seatCount) != flight.bookedCount) {
+                out << "Flight " << flight.flightNumber << ": seat counts disagree with passengers\n";
+                problems++;
+            }
+            
+            auto calendar = routeCalendars.find(routeKey(flight.source, flight.destination));
+            int seatsLeft;
+            double lowestFare;
+            if(flight.date.valid() &&
+               (calendar == routeCalendars.end() || !calendar->second->share(flight.date, flight.slot, seatsLeft, lowestFare) ||
+                seatsLeft != flight.seatCount - flight.bookedCount || lowestFare != quoteFlight(flight).lowestFare)) {
+                out << "Flight " << flight.flightNumber << ": route calendar is out of date\n";
+                problems++;
+            }
+            passengerCount += flight.passengers.size();
         }
         
-        flightFile.close();
-        
-        // Save booking history
-        ofstream historyFile("bookingHistory.txt");
-        if(!historyFile.is_open()) {
-            cout << "Error saving booking history!" << endl;
-            return;
+        for(auto& calendar : routeCalendars) {
+            size_t stale = calendar.second->staleDays();
+            if(stale) {
+                out << "Route calendar has " << stale << " days whose totals disagree with their flights\n";
+                problems++;
+            }
         }
         
-        for(const auto& entry : bookingHistory) {
-            historyFile << entry.first << "|";
-            for(const auto& ticketNum : entry.second) {
-                historyFile << ticketNum << ",";
+        if(ticketIndex.size() != passengerCount) {
+            out << "Ticket index holds " << ticketIndex.size() << " tickets for " << passengerCount << " passengers\n";
+            problems++;
+        }
+
+        size_t customerBookings = 0;
+        customerIndex.forEach([&](const string& phone, const vector<PassengerId>& bookings) {
+            for(PassengerId id : bookings) {
+                uint32_t slot = passengerStore.flightSlot(id);
+                if(passengerStore.phone(id) != phone || slot >= slotIndex.size() || slotIndex[slot] == NO_FLIGHT) {
+                    out << "Customer " << phone << ": ticket " << passengerStore.ticketNumber(id) << " does not lead to its booking\n";
+                    problems++;
+                }
             }
-            historyFile << endl;
+            customerBookings += bookings.size();
+        });
+        if(customerBookings != passengerCount) {
+            out << "Customer index holds " << customerBookings << " bookings for " << passengerCount << " passengers\n";
+            problems++;
         }
-        
-        historyFile.close();
+        return problems;
     }
     
-    void loadData() {
-        ifstream flightFile("flights.txt");
-        if(!flightFile.is_open()) {
-            cout << "No saved flight data found. Starting fresh." << endl;
-            return;
-        }
-        
-        flights.clear();
+    // Command stream - one pipe-separated command per line, one or more
+    // pipe-separated result lines per command:
+    //   BOOK|flight|seat|name|email|phone    -> OK|ticket|seat|price
+    //   CANCEL|ticket                        -> OK|ticket, plus |ticket of the waitlisted passenger given the seat
+    //   HOLD|flight|seat|seconds             -> OK|token|flight|seat|seconds; seconds may be blank
+    //   RELEASE|token                        -> OK|token
+    //   BOOKHOLD|token|name|email|phone      -> as BOOK, on the held seat
+    //   GROUP|flight|class|name|email|phone|name|email|phone|... -> OK|count|total|ADJACENT or SPLIT,
+    //                                        then MEMBER|ticket|seat|fare per passenger; class may be blank
+    //   WAIT|flight|class|name|email|phone   -> OK|entry|tier|position, once the class is full
+    //   UNWAIT|flight|entry                  -> OK|entry
+    //   WAITLIST|flight                      -> OK|count, then WAITING|entry|class|tier|name|phone in promotion order
+    //   AVAILABILITY|source|destination|MM/YYYY -> OK|days, then DAY|date|flights|seats left|lowest fare
+    //                                        for every day of the month; the fare is blank when nothing is bookable
+    //   SEARCH|source|destination|date|max   -> OK|count, then FLIGHT|... per match
+    //   SCHEDULE|source|destination|from|to|earliest|latest|max -> as SEARCH, dates
+    //                                        DD/MM/YYYY and departure times HH:MM, any may be blank
+    //   ADD|<flight line as in flights.txt>  -> OK|flight
+    //   DELETE|flight                        -> OK|flight
+    //   STATUS|flight|ON_TIME|DELAYED|CANCELED (or 0-2) -> OK|flight|status
+    //   HISTORY|phone                        -> OK|count, then TICKET|... per ticket
+    //   TICKET|ticket                        -> OK|lines, then TEXT|... per line of the ticket
+    //   DURABILITY|SYNC|ASYNC                -> OK|policy
+    //   FLUSH                                -> OK once everything queued is on disk
+    //   QUOTE|flight                         -> OK|seats, then SEAT|number|label|class|fare|AVAILABLE, HELD or BOOKED
+    //   FARES|source|destination|from|to     -> OK|count, then FARE|flight|date|time|lowest|class,fare,left;...
+    //   FARECURVE|id or definition           -> OK|curve; blank shows the curve in use
+    //   CONNECT|source|destination|from|to|ARRIVAL or FARE|limit|legs -> OK|count, then per
+    //                                        itinerary ROUTE|legs|departs|arrives|fare and a
+    //                                        LEG|flight|source|destination|date|departs|arrives|fare per flight
+    //   MCT|airport|minutes or MCT|DEFAULT|minutes|layover -> OK|rule; MCT alone lists the rules
+    // Failures are reported as ERR|message. Blank lines and lines starting with # are skipped.
+    void runCommands(istream& in, ostream& out) {
         string line;
+        while(getline(in, line)) {
+            if(!line.empty() && line.back() == '\r') line.pop_back();
+            if(line.empty() || line[0] == '#') continue;
+            
+            try {
+                executeCommand(line, out);
+            } catch(const exception&) {
+                out << "ERR|Malformed command\n";
+            }
+        }
+        out.flush();
+    }
+    
+    static void writeFlightList(ostream& out, const vector<Flight*>& results) {
+        out << "OK|" << results.size() << "\n";
+        for(const Flight* flight : results) {
+            out << "FLIGHT|" << flight->flightNumber << "|"
+                << flight->sourceName() << "|"
+                << flight->destinationName() << "|"
+                << flight->date << "|"
+                << flight->sourceTime << "|"
+                << flight->destinationTime << "|"
+                << flight->basePrice << "|"
+                << flightStatusName(flight->status) << "|"
+                << (flight->seatCount - flight->bookedCount) << "\n";
+        }
+    }
+    
+    void executeCommand(const string& line, ostream& out) {
+        stringstream ss(line);
+        string command;
+        getline(ss, command, '|');
+        transform(command.begin(), command.end(), command.begin(), ::toupper);
         
-        while(getline(flightFile, line)) {
-            if(line.empty()) continue;
+        if(command == "BOOK") {
+            string flightNumber, seatStr, name, email, phone;
+            getline(ss, flightNumber, '|');
+            getline(ss, seatStr, '|');
+            getline(ss, name, '|');
+            getline(ss, email, '|');
+            getline(ss, phone, '|');
             
-            Flight flight;
-            stringstream ss(line);
-            string token;
+            Passenger booked;
+            double price = 0;
+            BookingResult result = bookSeat(flightNumber, stoi(seatStr), name, email, phone, booked, price);
+            if(result != BOOKED) {
+                out << "ERR|" << bookingResultMessage(result) << "\n";
+                return;
+            }
+            out << "OK|" << booked.ticketNumber << "|" << booked.seatNumber << "|"
+                << fixed << setprecision(2) << price << "\n";
+        } else if(command == "HOLD") {
+            string flightNumber, seatStr, secondsStr;
+            getline(ss, flightNumber, '|');
+            getline(ss, seatStr, '|');
+            getline(ss, secondsStr, '|');
+            
+            uint64_t token = 0;
+            int seconds = secondsStr.empty() ? SEAT_HOLD_SECONDS : stoi(secondsStr);
+            BookingResult result = holdSeat(flightNumber, stoi(seatStr), seconds, token);
+            if(result != HELD) {
+                out << "ERR|" << bookingResultMessage(result) << "\n";
+                return;
+            }
+            out << "OK|" << token << "|" << flightNumber << "|" << seatStr << "|" << seconds << "\n";
+        } else if(command == "RELEASE") {
+            string tokenStr;
+            getline(ss, tokenStr, '|');
+            
+            if(releaseHold(stoull(tokenStr))) {
+                out << "OK|" << tokenStr << "\n";
+            } else {
+                out << "ERR|" << bookingResultMessage(HOLD_EXPIRED) << "\n";
+            }
+        } else if(command == "BOOKHOLD") {
+            string tokenStr, name, email, phone;
+            getline(ss, tokenStr, '|');
+            getline(ss, name, '|');
+            getline(ss, email, '|');
+            getline(ss, phone, '|');
+            
+            Passenger booked;
+            double price = 0;
+            BookingResult result = bookHeldSeat(stoull(tokenStr), name, email, phone, booked, price);
+            if(result != BOOKED) {
+                out << "ERR|" << bookingResultMessage(result) << "\n";
+                return;
+            }
+            out << "OK|" << booked.ticketNumber << "|" << booked.seatNumber << "|"
+                << fixed << setprecision(2) << price << "\n";
+        } else if(command == "GROUP") {
+            GroupBooking group;
+            string classStr, name;
+            getline(ss, group.flightNumber, '|');
+            getline(ss, classStr, '|');
+            if(!classStr.empty()) {
+                if(!parseSeatClass(classStr, group.seatClass)) {
+                    out << "ERR|Unknown seat class\n";
+                    return;
+                }
+                group.anyClass = false;
+            }
+            while(getline(ss, name, '|')) {
+                Passenger member;
+                member.name = name;
+                getline(ss, member.email, '|');
+                getline(ss, member.phone, '|');
+                group.party.push_back(member);
+            }
+            
+            BookingResult result = bookGroup(group);
+            if(result != BOOKED) {
+                out << "ERR|" << bookingResultMessage(result) << "\n";
+                return;
+            }
+            out << fixed << setprecision(2) << "OK|" << group.party.size() << "|" << group.totalFare << "|"
+                << (group.adjacent ? "ADJACENT" : "SPLIT") << "\n";
+            for(size_t i = 0; i < group.party.size(); i++) {
+                out << "MEMBER|" << group.party[i].ticketNumber << "|" << group.party[i].seatNumber << "|"
+                    << group.fares[i] << "\n";
+            }
+        } else if(command == "AVAILABILITY") {
+            string source, destination, monthStr;
+            getline(ss, source, '|');
+            getline(ss, destination, '|');
+            getline(ss, monthStr, '|');
+            
+            int month = 0, year = 0;
+            char slash = 0;
+            stringstream monthIn(monthStr);
+            if(!(monthIn >> month >> slash >> year) || slash != '/' || month < 1 || month > 12) {
+                out << "ERR|Invalid month\n";
+                return;
+            }
+            
+            vector<RouteDay> days = routeMonth(source, destination, year, month);
+            out << "OK|" << days.size() << "\n" << fixed << setprecision(2);
+            for(const auto& day : days) {
+                out << "DAY|" << day.date << "|" << day.flights << "|" << day.seatsLeft << "|";
+                if(day.lowestFare > 0) out << day.lowestFare;
+                out << "\n";
+            }
+        } else if(command == "WAIT") {
+            string flightNumber, classStr, name, email, phone;
+            getline(ss, flightNumber, '|');
+            getline(ss, classStr, '|');
+            getline(ss, name, '|');
+            getline(ss, email, '|');
+            getline(ss, phone, '|');
+            
+            SeatClass seatClass;
+            if(!parseSeatClass(classStr, seatClass)) {
+                out << "ERR|Unknown seat class\n";
+                return;
+            }
+            WaitlistEntry entry;
+            size_t position = 0;
+            BookingResult result = joinWaitlist(flightNumber, seatClass, name, email, phone, entry, position);
+            if(result != WAITLISTED) {
+                out << "ERR|" << bookingResultMessage(result) << "\n";
+                return;
+            }
+            out << "OK|" << entry.id << "|" << loyaltyTierName(entry.tier) << "|" << position << "\n";
+        } else if(command == "UNWAIT") {
+            string flightNumber, idStr;
+            getline(ss, flightNumber, '|');
+            getline(ss, idStr, '|');
+            
+            if(leaveWaitlist(flightNumber, stoull(idStr))) {
+                out << "OK|" << idStr << "\n";
+            } else {
+                out << "ERR|Not on the waitlist\n";
+            }
+        } else if(command == "WAITLIST") {
+            string flightNumber;
+            getline(ss, flightNumber, '|');
             
-            getline(ss, flight.flightNumber, '|');
-            getline(ss, flight.source, '|');
-            getline(ss, flight.destination, '|');
-            getline(ss, flight.sourceTime, '|');
-            getline(ss, flight.destinationTime, '|');
-            getline(ss, flight.date, '|');
+            vector<WaitlistEntry> entries;
+            if(!waitlistEntries(flightNumber, entries)) {
+                out << "ERR|" << bookingResultMessage(FLIGHT_NOT_FOUND) << "\n";
+                return;
+            }
+            out << "OK|" << entries.size() << "\n";
+            for(const auto& entry : entries) {
+                out << "WAITING|" << entry.id << "|" << seatClassName(entry.seatClass) << "|"
+                    << loyaltyTierName(entry.tier) << "|" << entry.name << "|" << entry.phone << "\n";
+            }
+        } else if(command == "CANCEL") {
+            string ticketNumber;
+            getline(ss, ticketNumber, '|');
             
-            string priceStr, stopsStr, statusStr;
+            string promotedTicket;
+            if(cancelBooking(ticketNumber, promotedTicket)) {
+                out << "OK|" << ticketNumber << (promotedTicket.empty() ? "" : "|" + promotedTicket) << "\n";
+            } else {
+                out << "ERR|Ticket not found\n";
+            }
+        } else if(command == "SEARCH") {
+            string source, destination, date, priceStr;
+            getline(ss, source, '|');
+            getline(ss, destination, '|');
+            getline(ss, date, '|');
             getline(ss, priceStr, '|');
-            getline(ss, flight.via, '|');
-            getline(ss, stopsStr, '|');
-            getline(ss, statusStr, '|');
             
-            flight.basePrice = stod(priceStr);
-            flight.stops = stoi(stopsStr);
-            flight.status = static_cast<FlightStatus>(stoi(statusStr));
+            writeFlightList(out, searchFlights(source, destination, date, priceStr.empty() ? -1 : stod(priceStr)));
+        } else if(command == "SCHEDULE") {
+            ScheduleQuery query;
+            string fromStr, toStr, earliestStr, latestStr, priceStr;
+            getline(ss, query.source, '|');
+            getline(ss, query.destination, '|');
+            getline(ss, fromStr, '|');
+            getline(ss, toStr, '|');
+            getline(ss, earliestStr, '|');
+            getline(ss, latestStr, '|');
+            getline(ss, priceStr, '|');
             
-            // Load seat data
-            if(getline(flightFile, line)) {
-                stringstream seatss(line);
-                string seatData;
-                
-                while(getline(seatss, seatData, ';')) {
-                    if(seatData.empty()) continue;
-                    
-                    stringstream seatStream(seatData);
-                    string seatNumStr, isBookedStr, typeStr, basePriceStr;
-                    
-                    getline(seatStream, seatNumStr, ',');
-                    getline(seatStream, isBookedStr, ',');
-                    getline(seatStream, typeStr, ',');
-                    getline(seatStream, basePriceStr, ',');
-                    
-                    Seat seat(stoi(seatNumStr), static_cast<SeatClass>(stoi(typeStr)));
-                    seat.isBooked = (isBookedStr == "1");
-                    seat.basePrice = stod(basePriceStr);
-                    
-                    flight.seats.push_back(seat);
-                }
+            if((!fromStr.empty() && !FlightDate::parse(fromStr, query.fromDate)) ||
+               (!toStr.empty() && !FlightDate::parse(toStr, query.toDate)) ||
+               (!earliestStr.empty() && !FlightTime::parse(earliestStr, query.earliest)) ||
+               (!latestStr.empty() && !FlightTime::parse(latestStr, query.latest))) {
+                out << "ERR|Invalid date or time\n";
+                return;
             }
+            if(!priceStr.empty()) query.maxPrice = stod(priceStr);
             
-            // Load passenger data
-            if(getline(flightFile, line)) {
-                stringstream passss(line);
-                string passData;
-                
-                while(getline(passss, passData, ';')) {
-                    if(passData.empty()) continue;
-                    
-                    stringstream passStream(passData);
-                    string name, email, phone, seatNumStr, ticketNumber;
-                    
-                    getline(passStream, name, ',');
-                    getline(passStream, email, ',');
-                    getline(passStream, phone, ',');
-                    getline(passStream, seatNumStr, ',');
-                    getline(passStream, ticketNumber, ',');
-                    
-                    Passenger passenger;
-                    passenger.name = name;
-                    passenger.email = email;
-                    passenger.phone = phone;
-                    passenger.seatNumber = stoi(seatNumStr);
-                    passenger.ticketNumber = ticketNumber;
-                    
-                    flight.passengers.push_back(passenger);
-                }
+            writeFlightList(out, searchSchedule(query));
+        } else if(command == "ADD") {
+            Flight flight;
+            if(!parseFlightHeader(ss, flight)) {
+                out << "ERR|Unknown aircraft layout\n";
+                return;
+            }
+            if(!flight.date.valid() || !flight.sourceTime.valid() || !flight.destinationTime.valid()) {
+                out << "ERR|Invalid date or time\n";
+                return;
             }
             
-            flights.push_back(flight);
-        }
-        
-        flightFile.close();
-        
-        // Load booking history
-        ifstream historyFile("bookingHistory.txt");
-        if(!historyFile.is_open()) {
-            cout << "No booking history found." << endl;
-            return;
-        }
-        
-        bookingHistory.clear();
-        
-        while(getline(historyFile, line)) {
-            if(line.empty()) continue;
+            if(addNewFlight(flight)) {
+                out << "OK|" << flight.flightNumber << "\n";
+            } else {
+                out << "ERR|Flight already exists\n";
+            }
+        } else if(command == "DELETE") {
+            string flightNumber;
+            getline(ss, flightNumber, '|');
             
-            stringstream ss(line);
-            string phone, ticketsStr;
+            if(removeFlight(flightNumber)) {
+                out << "OK|" << flightNumber << "\n";
+            } else {
+                out << "ERR|" << bookingResultMessage(FLIGHT_NOT_FOUND) << "\n";
+            }
+        } else if(command == "STATUS") {
+            string flightNumber, statusStr;
+            getline(ss, flightNumber, '|');
+            getline(ss, statusStr, '|');
+            transform(statusStr.begin(), statusStr.end(), statusStr.begin(), ::toupper);
+            
+            FlightStatus status;
+            if(statusStr == "ON_TIME" || statusStr == "0") status = ON_TIME;
+            else if(statusStr == "DELAYED" || statusStr == "1") status = DELAYED;
+            else if(statusStr == "CANCELED" || statusStr == "2") status = CANCELED;
+            else {
+                out << "ERR|Invalid status\n";
+                return;
+            }
             
+            if(!setFlightStatus(flightNumber, status)) {
+                out << "ERR|" << bookingResultMessage(FLIGHT_NOT_FOUND) << "\n";
+                return;
+            }
+            out << "OK|" << flightNumber << "|" << flightStatusName(status) << "\n";
+        } else if(command == "HISTORY") {
+            string phone;
             getline(ss, phone, '|');
-            getline(ss, ticketsStr);
             
-            stringstream ticketsSS(ticketsStr);
-            string ticket;
-            vector<string> tickets;
+            vector<BookingHistoryEntry> history = bookingHistoryOf(phone);
+            out << "OK|" << history.size() << "\n";
+            for(const auto& entry : history) {
+                out << "TICKET|" << entry.ticketNumber << "|" << entry.flightNumber << "|"
+                    << entry.source << "|" << entry.destination << "|"
+                    << entry.date << "|" << flightStatusName(entry.status) << "\n";
+            }
+        } else if(command == "TICKET") {
+            string ticketNumber, text, line;
+            getline(ss, ticketNumber, '|');
+            
+            if(!ticketText(ticketNumber, text)) {
+                out << "ERR|Ticket not found\n";
+                return;
+            }
+            
+            stringstream lines(text);
+            vector<string> textLines;
+            while(getline(lines, line)) textLines.push_back(line);
+            out << "OK|" << textLines.size() << "\n";
+            for(const auto& textLine : textLines) {
+                out << "TEXT|" << textLine << "\n";
+            }
+        } else if(command == "DURABILITY") {
+            string policyStr;
+            getline(ss, policyStr, '|');
+            transform(policyStr.begin(), policyStr.end(), policyStr.begin(), ::toupper);
+            
+            if(policyStr == "SYNC") {
+                setDurabilityPolicy(SYNC_COMMIT);
+            } else if(policyStr == "ASYNC") {
+                setDurabilityPolicy(ASYNC_COMMIT);
+            } else {
+                out << "ERR|Unknown durability policy\n";
+                return;
+            }
+            out << "OK|" << policyStr << "\n";
+        } else if(command == "FLUSH") {
+            if(flushJournal()) {
+                out << "OK\n";
+            } else {
+                out << "ERR|Journal write failed\n";
+            }
+        } else if(command == "QUOTE") {
+            string flightNumber;
+            getline(ss, flightNumber, '|');
+            
+            SeatMapQuote quote;
+            if(!quoteSeatMap(flightNumber, quote)) {
+                out << "ERR|" << bookingResultMessage(FLIGHT_NOT_FOUND) << "\n";
+                return;
+            }
+            
+            out << "OK|" << quote.layout->seatCount << "\n" << fixed << setprecision(2);
+            for(int seatNum = 1; seatNum <= quote.layout->seatCount; seatNum++) {
+                out << "SEAT|" << seatNum << "|" << quote.layout->seatLabel(seatNum) << "|"
+                    << seatClassName(quote.layout->cabinOf(seatNum).type) << "|" << quote.fares[seatNum] << "|"
+                    << seatStateName(quote.states[seatNum]) << "\n";
+            }
+        } else if(command == "FARES") {
+            ScheduleQuery query;
+            string fromStr, toStr;
+            getline(ss, query.source, '|');
+            getline(ss, query.destination, '|');
+            getline(ss, fromStr, '|');
+            getline(ss, toStr, '|');
+            
+            if((!fromStr.empty() && !FlightDate::parse(fromStr, query.fromDate)) ||
+               (!toStr.empty() && !FlightDate::parse(toStr, query.toDate))) {
+                out << "ERR|Invalid date or time\n";
+                return;
+            }
+            
+            vector<FlightQuote> quotes = quoteSchedule(query);
+            out << "OK|" << quotes.size() << "\n" << fixed << setprecision(2);
+            for(const auto& quote : quotes) {
+                const Flight& flight = *quote.flight;
+                out << "FARE|" << flight.flightNumber << "|" << flight.date << "|" << flight.sourceTime << "|";
+                if(quote.lowestFare > 0) out << quote.lowestFare;
+                out << "|";
+                for(size_t i = 0; i < flight.layout->cabins.size(); i++) {
+                    out << (i ? ";" : "") << seatClassName(flight.layout->cabins[i].type) << ","
+                        << quote.cabinFares[i] << "," << quote.cabinSeatsLeft[i];
+                }
+                out << "\n";
+            }
+        } else if(command == "FARECURVE") {
+            string definition;
+            getline(ss, definition);
+            
+            const FareCurve* curve = definition.empty() ? &activeFareCurve() : selectFareCurve(definition);
+            if(!curve) {
+                out << "ERR|Unknown or invalid fare curve\n";
+                return;
+            }
+            out << "OK|" << FareCurveRegistry::describe(*curve) << "\n";
+        } else if(command == "CONNECT") {
+            ConnectionQuery query;
+            string fromStr, toStr, orderStr, limitStr, legsStr;
+            getline(ss, query.source, '|');
+            getline(ss, query.destination, '|');
+            getline(ss, fromStr, '|');
+            getline(ss, toStr, '|');
+            getline(ss, orderStr, '|');
+            getline(ss, limitStr, '|');
+            getline(ss, legsStr, '|');
+            transform(orderStr.begin(), orderStr.end(), orderStr.begin(), ::toupper);
+            
+            int limit = static_cast<int>(query.limit);
+            if((!fromStr.empty() && !FlightDate::parse(fromStr, query.fromDate)) ||
+               (!toStr.empty() && !FlightDate::parse(toStr, query.toDate))) {
+                out << "ERR|Invalid date or time\n";
+                return;
+            }
+            if((!orderStr.empty() && orderStr != "ARRIVAL" && orderStr != "FARE") ||
+               (!limitStr.empty() && !parseNumber(limitStr, 0, limitStr.size(), limit)) ||
+               (!legsStr.empty() && !parseNumber(legsStr, 0, legsStr.size(), query.maxLegs))) {
+                out << "ERR|Invalid order, limit or leg count\n";
+                return;
+            }
+            query.order = (orderStr == "FARE") ? LOWEST_FARE : EARLIEST_ARRIVAL;
+            query.limit = limit;
             
-            while(getline(ticketsSS, ticket, ',')) {
-                if(!ticket.empty()) {
-                    tickets.push_back(ticket);
+            vector<Itinerary> itineraries = searchConnections(query);
+            out << "OK|" << itineraries.size() << "\n" << fixed << setprecision(2);
+            for(const auto& itinerary : itineraries) {
+                out << "ROUTE|" << itinerary.legs.size() << "|" << formatTimestamp(itinerary.departs) << "|"
+                    << formatTimestamp(itinerary.arrives) << "|" << itinerary.totalFare << "\n";
+                for(const auto& leg : itinerary.legs) {
+                    const Flight& flight = *leg.flight;
+                    out << "LEG|" << flight.flightNumber << "|" << flight.sourceName() << "|"
+                        << flight.destinationName() << "|" << flight.date << "|" << flight.sourceTime << "|"
+                        << flight.destinationTime << "|" << leg.lowestFare << "\n";
                 }
             }
+        } else if(command == "MCT") {
+            string rule;
+            getline(ss, rule);
             
-            bookingHistory[phone] = tickets;
+            if(rule.empty()) {
+                ConnectionRules rules = activeConnectionRules();
+                out << "OK|" << (rules.minimum.size() + 1) << "\n";
+                out << "MCT|DEFAULT|" << rules.defaultMinimum << "|" << rules.maxLayover << "\n";
+                for(const auto& entry : rules.minimum) {
+                    out << "MCT|" << airports().name(entry.first) << "|" << entry.second << "\n";
+                }
+            } else if(setConnectionRule(rule)) {
+                out << "OK|" << rule << "\n";
+            } else {
+                out << "ERR|Invalid connection rule\n";
+            }
+        } else {
+            out << "ERR|Unknown command " << command << "\n";
         }
-        
-        historyFile.close();
-    }
-    
-public:
-    FlightBookingSystem() {
-        // Seed random number generator
-        srand(time(0));
-        loadData();
-    }
-    
-    ~FlightBookingSystem() {
-        saveData();
     }
     
     void clearScreen() {
+#ifdef _WIN32
         system("cls");
+#else
+        cout << "\033[2J\033[H" << flush;
+#endif
     }
     
     void displayTitle() {
@@ -365,7 +5923,12 @@ public:
     }
     
     void mainMenu() {
+        {
+            lock_guard<mutex> holdGuard(holdMutex);
+            holdsExpireInline = true;
+        }
         while(true) {
+            expireHolds();
             displayTitle();
             cout << "1. Login as User\n";
             cout << "2. Login as Admin\n";
@@ -412,6 +5975,7 @@ public:
     
     void adminDashboard() {
         while(true) {
+            expireHolds();
             displayTitle();
             cout << "ADMIN DASHBOARD\n\n";
             cout << "1. Add Flight\n";
@@ -420,7 +5984,8 @@ public:
             cout << "4. Delete Flight\n";
             cout << "5. Update Flight Status\n";
             cout << "6. View Bookings\n";
-            cout << "7. Log Out\n\n";
+            cout << "7. Fare Curves\n";
+            cout << "8. Log Out\n\n";
             cout << "Select an option: ";
             
             char choice;
@@ -446,6 +6011,9 @@ public:
                     viewBookings();
                     break;
                 case '7':
+                    manageFareCurves();
+                    break;
+                case '8':
                     return;
                 default:
                     cout << "\nInvalid option. Please try again.\n";
@@ -465,51 +6033,74 @@ public:
         cin >> flight.flightNumber;
         
         // Check if flight number already exists
-        for(const auto& f : flights) {
-            if(f.flightNumber == flight.flightNumber) {
-                cout << "\nError: Flight with this number already exists!\n";
-                cout << "Press any key to continue...";
-                getch();
-                return;
-            }
+        if(findFlight(flight.flightNumber)) {
+            cout << "\nError: Flight with this number already exists!\n";
+            cout << "Press any key to continue...";
+            getch();
+            return;
         }
         
         cin.ignore();
+        string source, destination, via;
         cout << "Enter Source: ";
-        getline(cin, flight.source);
+        getline(cin, source);
+        flight.source = airports().intern(source);
         
         cout << "Enter Destination: ";
-        getline(cin, flight.destination);
+        getline(cin, destination);
+        flight.destination = airports().intern(destination);
         
+        string sourceTime, destinationTime, date;
         cout << "Enter Source Time (HH:MM): ";
-        getline(cin, flight.sourceTime);
+        getline(cin, sourceTime);
         
         cout << "Enter Destination Time (HH:MM): ";
-        getline(cin, flight.destinationTime);
+        getline(cin, destinationTime);
         
             cout << "Enter Date (DD/MM/YYYY): ";
-            getline(cin, flight.date);
+            getline(cin, date);
+            
+            if(!FlightTime::parse(sourceTime, flight.sourceTime) ||
+               !FlightTime::parse(destinationTime, flight.destinationTime) ||
+               !FlightDate::parse(date, flight.date)) {
+                cout << "\nError: Invalid date or time!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
             
             cout << "Enter Base Price: ";
             cin >> flight.basePrice;
             
             cin.ignore();
             cout << "Enter Via (If any, otherwise leave blank): ";
-            getline(cin, flight.via);
+            getline(cin, via);
+            flight.via = airports().intern(via);
             
             cout << "Enter Number of Stops: ";
             cin >> flight.stops;
             
-            // Initialize seats
-            for(int i = 1; i <= 30; i++) {
-                flight.seats.push_back(Seat(i, ECONOMY));
+            // Initialize seats from the chosen aircraft layout
+            cin.ignore();
+            string layoutId;
+            cout << "Aircraft Layout (";
+            const auto& layouts = seatLayouts().all();
+            for(size_t i = 0; i < layouts.size(); i++) {
+                cout << (i ? ", " : "") << layouts[i].id << " " << layouts[i].seatCount;
             }
-            for(int i = 31; i <= 40; i++) {
-                flight.seats.push_back(Seat(i, BUSINESS));
+            cout << " seats; leave blank for " << seatLayouts().defaultLayout()->id << "): ";
+            getline(cin, layoutId);
+            
+            const SeatLayout* layout = layoutId.empty() ? seatLayouts().defaultLayout() : seatLayouts().find(layoutId);
+            if(!layout) {
+                cout << "\nError: Unknown aircraft layout!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
             }
+            flight.setLayout(layout);
             
-            flights.push_back(flight);
-            saveData();
+            addNewFlight(flight);
             
             cout << "\nFlight added successfully!\n";
             cout << "Press any key to continue...";
@@ -527,29 +6118,9 @@ public:
                 return;
             }
             
-            cout << left << setw(10) << "Flight#" 
-                 << setw(15) << "Source" 
-                 << setw(15) << "Destination" 
-                 << setw(10) << "Date" 
-                 << setw(10) << "Price" 
-                 << setw(10) << "Status" << endl;
-            cout << string(70, '-') << endl;
-            
-            for(const auto& flight : flights) {
-                string statusStr;
-                switch(flight.status) {
-                    case ON_TIME: statusStr = "On Time"; break;
-                    case DELAYED: statusStr = "Delayed"; break;
-                    case CANCELED: statusStr = "Canceled"; break;
-                }
-                
-                cout << left << setw(10) << flight.flightNumber 
-                     << setw(15) << flight.source 
-                     << setw(15) << flight.destination 
-                     << setw(10) << flight.date 
-                     << setw(10) << flight.basePrice 
-                     << setw(10) << statusStr << endl;
-            }
+            ReportWriter report(cout, TABLE_REPORT, flightReportColumns());
+            writeFlightReport(report);
+            report.finish();
             
             cout << "\nPress any key to continue...";
             getch();
@@ -566,67 +6137,73 @@ public:
                 return;
             }
             
-            string flightNumber;
-            cout << "Enter Flight Number to modify: ";
-            cin >> flightNumber;
-            
-            for(auto& flight : flights) {
-                if(flight.flightNumber == flightNumber) {
-                    cin.ignore();
-                    cout << "\nCurrent details:\n";
-                    cout << "Source: " << flight.source << endl;
-                    cout << "Destination: " << flight.destination << endl;
-                    cout << "Source Time: " << flight.sourceTime << endl;
-                    cout << "Destination Time: " << flight.destinationTime << endl;
-                    cout << "Date: " << flight.date << endl;
-                    cout << "Base Price: " << flight.basePrice << endl;
-                    cout << "Via: " << flight.via << endl;
-                    cout << "Stops: " << flight.stops << endl;
-                    
-                    cout << "\nEnter new details (press Enter to keep current):\n";
-                    
-                    string input;
-                    
-                    cout << "Source: ";
-                    getline(cin, input);
-                    if(!input.empty()) flight.source = input;
-                    
-                    cout << "Destination: ";
-                    getline(cin, input);
-                    if(!input.empty()) flight.destination = input;
-                    
-                    cout << "Source Time (HH:MM): ";
-                    getline(cin, input);
-                    if(!input.empty()) flight.sourceTime = input;
-                    
-                    cout << "Destination Time (HH:MM): ";
-                    getline(cin, input);
-                    if(!input.empty()) flight.destinationTime = input;
-                    
-                    cout << "Date (DD/MM/YYYY): ";
-                    getline(cin, input);
-                    if(!input.empty()) flight.date = input;
-                    
-                    cout << "Base Price: ";
-                    getline(cin, input);
-                    if(!input.empty()) flight.basePrice = stod(input);
-                    
-                    cout << "Via: ";
-                    getline(cin, input);
-                    if(!input.empty()) flight.via = input;
-                    
-                    cout << "Stops: ";
-                    getline(cin, input);
-                    if(!input.empty()) flight.stops = stoi(input);
-                    
-                    saveData();
-                    cout << "\nFlight details modified successfully!\n";
-                    cout << "Press any key to continue...";
-                    getch();
-                    return;
-                }
-            }
-            
+            string flightNumber;
+            cout << "Enter Flight Number to modify: ";
+            cin >> flightNumber;
+            
+            Flight* flight = findFlight(flightNumber);
+            if(flight) {
+                Flight details = *flight;
+                cin.ignore();
+                cout << "\nCurrent details:\n";
+                cout << "Source: " << details.sourceName() << endl;
+                cout << "Destination: " << details.destinationName() << endl;
+                cout << "Source Time: " << details.sourceTime << endl;
+                cout << "Destination Time: " << details.destinationTime << endl;
+                cout << "Date: " << details.date << endl;
+                cout << "Base Price: " << details.basePrice << endl;
+                cout << "Via: " << details.viaName() << endl;
+                cout << "Stops: " << details.stops << endl;
+                
+                cout << "\nEnter new details (press Enter to keep current):\n";
+                
+                string input;
+                
+                cout << "Source: ";
+                getline(cin, input);
+                if(!input.empty()) details.source = airports().intern(input);
+                
+                cout << "Destination: ";
+                getline(cin, input);
+                if(!input.empty()) details.destination = airports().intern(input);
+                
+                cout << "Source Time (HH:MM): ";
+                getline(cin, input);
+                if(!input.empty() && !FlightTime::parse(input, details.sourceTime)) {
+                    cout << "Invalid time, keeping " << details.sourceTime << ".\n";
+                }
+                
+                cout << "Destination Time (HH:MM): ";
+                getline(cin, input);
+                if(!input.empty() && !FlightTime::parse(input, details.destinationTime)) {
+                    cout << "Invalid time, keeping " << details.destinationTime << ".\n";
+                }
+                
+                cout << "Date (DD/MM/YYYY): ";
+                getline(cin, input);
+                if(!input.empty() && !FlightDate::parse(input, details.date)) {
+                    cout << "Invalid date, keeping " << details.date << ".\n";
+                }
+                
+                cout << "Base Price: ";
+                getline(cin, input);
+                if(!input.empty()) details.basePrice = stod(input);
+                
+                cout << "Via: ";
+                getline(cin, input);
+                if(!input.empty()) details.via = airports().intern(input);
+                
+                cout << "Stops: ";
+                getline(cin, input);
+                if(!input.empty()) details.stops = stoi(input);
+                
+                updateFlightDetails(details);
+                cout << "\nFlight details modified successfully!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
             cout << "\nFlight not found!\n";
             cout << "Press any key to continue...";
             getch();
@@ -647,29 +6224,29 @@ public:
             cout << "Enter Flight Number to delete: ";
             cin >> flightNumber;
             
-            for(auto it = flights.begin(); it != flights.end(); ++it) {
-                if(it->flightNumber == flightNumber) {
-                    // Check if there are any bookings
-                    if(!it->passengers.empty()) {
-                        cout << "\nWarning: This flight has booked passengers. Are you sure you want to delete? (Y/N): ";
-                        char confirm;
-                        cin >> confirm;
-                        
-                        if(toupper(confirm) != 'Y') {
-                            cout << "\nDeletion canceled.\n";
-                            cout << "Press any key to continue...";
-                            getch();
-                            return;
-                        }
-                    }
+            auto it = flightIndex.find(flightNumber);
+            if(it != flightIndex.end()) {
+                size_t flightPos = it->second;
+                
+                // Check if there are any bookings
+                if(!flights[flightPos].passengers.empty()) {
+                    cout << "\nWarning: This flight has booked passengers. Are you sure you want to delete? (Y/N): ";
+                    char confirm;
+                    cin >> confirm;
                     
-                    flights.erase(it);
-                    saveData();
-                    cout << "\nFlight deleted successfully!\n";
-                    cout << "Press any key to continue...";
-                    getch();
-                    return;
+                    if(toupper(confirm) != 'Y') {
+                        cout << "\nDeletion canceled.\n";
+                        cout << "Press any key to continue...";
+                        getch();
+                        return;
+                    }
                 }
+                
+                removeFlight(flightNumber);
+                cout << "\nFlight deleted successfully!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
             }
             
             cout << "\nFlight not found!\n";
@@ -710,10 +6287,11 @@ public:
                     char choice;
                     cin >> choice;
                     
+                    FlightStatus newStatus;
                     switch(choice) {
-                        case '1': flight.status = ON_TIME; break;
-                        case '2': flight.status = DELAYED; break;
-                        case '3': flight.status = CANCELED; break;
+                        case '1': newStatus = ON_TIME; break;
+                        case '2': newStatus = DELAYED; break;
+                        case '3': newStatus = CANCELED; break;
                         default:
                             cout << "\nInvalid choice. Status not updated.\n";
                             cout << "Press any key to continue...";
@@ -721,7 +6299,7 @@ public:
                             return;
                     }
                     
-                    saveData();
+                    setFlightStatus(flight.flightNumber, newStatus);
                     cout << "\nFlight status updated successfully!\n";
                     cout << "Press any key to continue...";
                     getch();
@@ -749,73 +6327,73 @@ public:
             cout << "Enter Flight Number (or 'all' to view all bookings): ";
             cin >> flightNumber;
             
-            if(flightNumber == "all") {
-                bool hasBookings = false;
-                
-                for(const auto& flight : flights) {
-                    if(!flight.passengers.empty()) {
-                        hasBookings = true;
-                        cout << "\nFlight: " << flight.flightNumber << " (" << flight.source << " to " << flight.destination << ")\n";
-                        cout << string(50, '-') << endl;
-                        cout << left << setw(20) << "Name" 
-                             << setw(15) << "Phone" 
-                             << setw(10) << "Seat" 
-                             << setw(15) << "Ticket#" << endl;
-                        cout << string(60, '-') << endl;
-                        
-                        for(const auto& passenger : flight.passengers) {
-                            cout << left << setw(20) << passenger.name 
-                                 << setw(15) << passenger.phone 
-                                 << setw(10) << passenger.seatNumber 
-                                 << setw(15) << passenger.ticketNumber << endl;
-                        }
-                        cout << endl;
-                    }
-                }
-                
-                if(!hasBookings) {
-                    cout << "\nNo bookings found across all flights.\n";
-                }
+            bool all = (flightNumber == "all");
+            Flight* flight = all ? nullptr : findFlight(flightNumber);
+            bool hasBookings = false;
+            for(const auto& candidate : flights) {
+                if(!candidate.passengers.empty()) hasBookings = true;
+            }
+            
+            if(!all && !flight) {
+                cout << "\nFlight not found!\n";
+            } else if(all ? !hasBookings : flight->passengers.empty()) {
+                cout << (all ? "\nNo bookings found across all flights.\n" : "\nNo bookings found for this flight.\n");
             } else {
-                bool found = false;
-                
-                for(const auto& flight : flights) {
-                    if(flight.flightNumber == flightNumber) {
-                        found = true;
-                        
-                        if(flight.passengers.empty()) {
-                            cout << "\nNo bookings found for this flight.\n";
-                        } else {
-                            cout << "\nFlight: " << flight.flightNumber << " (" << flight.source << " to " << flight.destination << ")\n";
-                            cout << string(50, '-') << endl;
-                            cout << left << setw(20) << "Name" 
-                                 << setw(15) << "Phone" 
-                                 << setw(10) << "Seat" 
-                                 << setw(15) << "Ticket#" << endl;
-                            cout << string(60, '-') << endl;
-                            
-                            for(const auto& passenger : flight.passengers) {
-                                cout << left << setw(20) << passenger.name 
-                                     << setw(15) << passenger.phone 
-                                     << setw(10) << passenger.seatNumber 
-                                     << setw(15) << passenger.ticketNumber << endl;
-                            }
-                        }
-                        break;
-                    }
-                }
-                
-                if(!found) {
-                    cout << "\nFlight not found!\n";
+                if(flight) {
+                    cout << "\nFlight: " << flight->flightNumber << " (" << flight->sourceName() << " to " << flight->destinationName() << ")\n";
                 }
+                cout << '\n';
+                ReportWriter report(cout, TABLE_REPORT, manifestColumns());
+                writeManifestReport(report, all ? "" : flightNumber);
+                report.finish();
             }
             
             cout << "\nPress any key to continue...";
             getch();
         }
         
+        void manageFareCurves() {
+            displayTitle();
+            cout << "FARE CURVES\n\n";
+            
+            const deque<FareCurve>& curves = fareCurves().all();
+            for(size_t i = 0; i < curves.size(); i++) {
+                cout << left << setw(5) << (i + 1) << FareCurveRegistry::describe(curves[i])
+                     << (&curves[i] == fareCurve ? "  (in use)" : "") << endl;
+            }
+            
+            cout << "\nEnter a curve number to use it, a new definition such as\n"
+                 << "PEAK|C|STEP|0:1,0.6:1.25,0.9:1.7, or leave blank to keep the current curve: ";
+            cin.ignore();
+            string input;
+            getline(cin, input);
+            if(input.empty()) return;
+            
+            string definition = input;
+            if(all_of(input.begin(), input.end(), ::isdigit)) {
+                size_t choice = stoul(input);
+                if(choice < 1 || choice > curves.size()) {
+                    cout << "\nInvalid selection!\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
+                }
+                definition = curves[choice - 1].id;
+            }
+            
+            const FareCurve* curve = selectFareCurve(definition);
+            if(curve) {
+                cout << "\nSeats are now priced with " << curve->id << ".\n";
+            } else {
+                cout << "\nUnknown or invalid fare curve.\n";
+            }
+            cout << "Press any key to continue...";
+            getch();
+        }
+        
         void userDashboard() {
             while(true) {
+                expireHolds();
                 displayTitle();
                 cout << "USER DASHBOARD\n\n";
                 cout << "1. Book Flight Ticket\n";
@@ -823,7 +6401,9 @@ public:
                 cout << "3. Cancel Ticket\n";
                 cout << "4. View Booking History\n";
                 cout << "5. Reprint Ticket\n";
-                cout << "6. Log Out\n\n";
+                cout << "6. Book Group Tickets\n";
+                cout << "7. Fare Calendar\n";
+                cout << "8. Log Out\n\n";
                 cout << "Select an option: ";
                 
                 char choice;
@@ -846,6 +6426,12 @@ public:
                         reprintTicket();
                         break;
                     case '6':
+                        bookGroupTickets();
+                        break;
+                    case '7':
+                        viewFareCalendar();
+                        break;
+                    case '8':
                         return;
                     default:
                         cout << "\nInvalid option. Please try again.\n";
@@ -877,16 +6463,17 @@ public:
             
             vector<Flight*> matchingFlights;
             
-            for(auto& flight : flights) {
-                if(flight.source == source && flight.destination == destination && flight.status != CANCELED) {
-                    matchingFlights.push_back(&flight);
+            AirportId sourceId, destinationId;
+            if(airports().find(source, sourceId) && airports().find(destination, destinationId)) {
+                for(size_t flightPos : findRoute(sourceId, destinationId)) {
+                    if(flights[flightPos].status != CANCELED) {
+                        matchingFlights.push_back(&flights[flightPos]);
+                    }
                 }
             }
             
             if(matchingFlights.empty()) {
-                cout << "\nNo flights found for the specified route.\n";
-                cout << "Press any key to continue...";
-                getch();
+                bookConnection(source, destination);
                 return;
             }
             
@@ -895,9 +6482,9 @@ public:
                  << setw(10) << "Flight#" 
                  << setw(15) << "Date" 
                  << setw(10) << "Time" 
-                 << setw(10) << "Price" 
+                 << setw(12) << "Fare From" 
                  << setw(10) << "Status" << endl;
-            cout << string(60, '-') << endl;
+            cout << string(62, '-') << endl;
             
             for(size_t i = 0; i < matchingFlights.size(); ++i) {
                 string statusStr;
@@ -907,11 +6494,12 @@ public:
                     case CANCELED: statusStr = "Canceled"; break;
                 }
                 
+                FlightQuote quote = quoteFlight(*matchingFlights[i]);
                 cout << left << setw(5) << (i + 1)
                      << setw(10) << matchingFlights[i]->flightNumber
                      << setw(15) << matchingFlights[i]->date
                      << setw(10) << matchingFlights[i]->sourceTime
-                     << setw(10) << matchingFlights[i]->basePrice
+                     << setw(12) << (quote.lowestFare > 0 ? formatFare(quote.lowestFare) : "Full")
                      << setw(10) << statusStr << endl;
             }
             
@@ -927,6 +6515,10 @@ public:
             }
             
             Flight* selectedFlight = matchingFlights[selection - 1];
+            if(selectedFlight->bookedCount >= selectedFlight->seatCount) {
+                offerWaitlist(*selectedFlight);
+                return;
+            }
             
             // Display seat map
             displaySeatMap(*selectedFlight);
@@ -935,19 +6527,29 @@ public:
             cout << "\nEnter seat number to book: ";
             cin >> seatNumber;
             
-                if(seatNumber < 1 || seatNumber > static_cast<int>(selectedFlight->seats.size())) {
+                if(seatNumber < 1 || seatNumber > selectedFlight->seatCount) {
                     cout << "\nInvalid seat number!\n";
                     cout << "Press any key to continue...";
                     getch();
                     return;
                 }
                 
-                if(!selectedFlight->isSeatAvailable(seatNumber)) {
+                // Hold the seat so nobody takes it while the details are entered
+                uint64_t holdToken;
+                BookingResult held = holdSeat(selectedFlight->flightNumber, seatNumber, SEAT_HOLD_SECONDS, holdToken);
+                if(held == SEAT_TAKEN) {
                     cout << "\nThis seat is already booked. Please select another seat.\n";
                     cout << "Press any key to continue...";
                     getch();
                     return;
                 }
+                if(held != HELD) {
+                    cout << "\n" << bookingResultMessage(held) << ". Please select another seat.\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
+                }
+                cout << "Seat " << seatNumber << " is held for you for " << SEAT_HOLD_SECONDS / 60 << " minutes.\n";
                 
                 // Get passenger details
                 cin.ignore();
@@ -964,22 +6566,21 @@ public:
                 getline(cin, phone);
                 
                 // Check for duplicate booking
-                for(const auto& passenger : selectedFlight->passengers) {
-                    if(passenger.phone == phone && passenger.name == name) {
-                        cout << "\nDuplicate booking detected! You have already booked a ticket on this flight.\n";
-                        cout << "Press any key to continue...";
-                        getch();
-                        return;
-                    }
+                if(hasDuplicateBooking(*selectedFlight, name, phone)) {
+                    releaseHold(holdToken);
+                    cout << "\nDuplicate booking detected! You have already booked a ticket on this flight.\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
                 }
                 
                 // Calculate ticket price with dynamic pricing
-                double seatPrice = selectedFlight->getSeatPrice(seatNumber);
+                double seatPrice = fareCurve->quoteSeat(*selectedFlight, seatNumber);
                 
                 // Confirm booking
                 cout << "\nBooking Summary:\n";
                 cout << "Flight: " << selectedFlight->flightNumber << endl;
-                cout << "Route: " << selectedFlight->source << " to " << selectedFlight->destination << endl;
+                cout << "Route: " << selectedFlight->sourceName() << " to " << selectedFlight->destinationName() << endl;
                 cout << "Date: " << selectedFlight->date << endl;
                 cout << "Time: " << selectedFlight->sourceTime << endl;
                 cout << "Seat: " << seatNumber << " (" << selectedFlight->getSeatType(seatNumber) << ")" << endl;
@@ -990,6 +6591,7 @@ public:
                 cin >> confirm;
                 
                 if(toupper(confirm) != 'Y') {
+                    releaseHold(holdToken);
                     cout << "\nBooking canceled.\n";
                     cout << "Press any key to continue...";
                     getch();
@@ -997,85 +6599,407 @@ public:
                 }
                 
                 // Create passenger and add to flight
-                Passenger newPassenger(name, email, phone, seatNumber);
-                selectedFlight->passengers.push_back(newPassenger);
-                selectedFlight->markSeatBooked(seatNumber);
-                
-                // Add to booking history
-                if(bookingHistory.find(phone) == bookingHistory.end()) {
-                    bookingHistory[phone] = vector<string>();
+                Passenger newPassenger;
+                BookingResult result = bookHeldSeat(holdToken, name, email, phone, newPassenger, seatPrice);
+                if(result != BOOKED) {
+                    releaseHold(holdToken);
+                    cout << "\nBooking failed: " << bookingResultMessage(result) << ".\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
                 }
-                bookingHistory[phone].push_back(newPassenger.ticketNumber);
-                
-                saveData();
                 
                 // Print ticket
-                generateTicket(*selectedFlight, newPassenger);
-                
-                cout << "\nBooking successful! Ticket has been saved.\n";
+                if(issueTicket(newPassenger.ticketNumber)) {
+                    cout << "\nBooking successful! Ticket " << newPassenger.ticketNumber
+                         << " has been saved to " << TICKET_ARCHIVE_FILE << ".\n";
+                } else {
+                    cout << "\nBooking successful, but the ticket could not be saved. Use Reprint Ticket to retry.\n";
+                }
                 cout << "Press any key to continue...";
                 getch();
             }
             
-            void displaySeatMap(const Flight& flight) {
-                displayTitle();
-                cout << "SEAT MAP - Flight " << flight.flightNumber << "\n\n";
-                
-                cout << "BUSINESS CLASS:\n";
-                cout << "---------------------------\n";
-                for(int i = 31; i <= 40; i++) {
-                    bool isAvailable = flight.isSeatAvailable(i);
-                    cout << "[" << (isAvailable ? " " : "X") << "] " << i << "\t";
-                    if((i - 30) % 5 == 0) cout << endl;
+        // The flight is full - put the passenger in line for the next seat freed
+        void offerWaitlist(const Flight& flight) {
+            cout << "\nFlight " << flight.flightNumber << " is full. Join the waitlist? (Y/N): ";
+            char confirm;
+            cin >> confirm;
+            if(toupper(confirm) != 'Y') return;
+            
+            cin.ignore();
+            string classStr, name, email, phone;
+            cout << "\nClass (";
+            for(size_t i = 0; i < flight.layout->cabins.size(); i++) {
+                cout << (i ? ", " : "") << seatClassName(flight.layout->cabins[i].type);
+            }
+            cout << "): ";
+            getline(cin, classStr);
+            
+            SeatClass seatClass;
+            if(!parseSeatClass(classStr, seatClass)) {
+                cout << "\nUnknown seat class!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
+            cout << "\nEnter passenger details:\n";
+            cout << "Name: ";
+            getline(cin, name);
+            
+            cout << "Email: ";
+            getline(cin, email);
+            
+            cout << "Phone: ";
+            getline(cin, phone);
+            
+            WaitlistEntry entry;
+            size_t position;
+            BookingResult result = joinWaitlist(flight.flightNumber, seatClass, name, email, phone, entry, position);
+            if(result != WAITLISTED) {
+                cout << "\nCould not join the waitlist: " << bookingResultMessage(result) << ".\n";
+            } else {
+                cout << "\nWaitlisted as entry " << entry.id << ", number " << position << " in line for "
+                     << seatClassName(seatClass) << " (loyalty tier: " << loyaltyTierName(entry.tier) << ").\n";
+                cout << "A " << seatClassName(seatClass) << " seat freed by a cancellation will be booked for you automatically.\n";
+            }
+            cout << "Press any key to continue...";
+            getch();
+        }
+        
+        // No direct flight on the route - offer itineraries with connections
+        // and book a seat on every leg for the same passenger
+        void bookConnection(const string& source, const string& destination) {
+            cout << "\nNo direct flights found for the specified route.\n";
+            
+            ConnectionQuery query;
+            query.source = source;
+            query.destination = destination;
+            
+            string date;
+            cout << "Travel date for a connecting trip (DD/MM/YYYY, blank for any): ";
+            getline(cin, date);
+            if(!date.empty()) {
+                if(!FlightDate::parse(date, query.fromDate)) {
+                    cout << "\nInvalid date!\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
+                }
+                query.toDate = query.fromDate;
+            }
+            
+            cout << "Order by (1) earliest arrival or (2) lowest fare: ";
+            string order;
+            getline(cin, order);
+            query.order = (order == "2") ? LOWEST_FARE : EARLIEST_ARRIVAL;
+            
+            vector<Itinerary> itineraries = searchConnections(query);
+            if(itineraries.empty()) {
+                cout << "\nNo connecting flights found either.\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
+            cout << "\nConnecting Itineraries:\n";
+            cout << left << setw(5) << "No."
+                 << setw(19) << "Departs"
+                 << setw(19) << "Arrives"
+                 << setw(7) << "Stops"
+                 << setw(12) << "Fare From"
+                 << "Flights" << endl;
+            cout << string(90, '-') << endl;
+            
+            for(size_t i = 0; i < itineraries.size(); i++) {
+                const Itinerary& itinerary = itineraries[i];
+                string legs;
+                for(const auto& leg : itinerary.legs) {
+                    legs += (legs.empty() ? "" : ", ") + leg.flight->flightNumber + " (" +
+                            leg.flight->sourceName() + "-" + leg.flight->destinationName() + ")";
                 }
+                cout << left << setw(5) << (i + 1)
+                     << setw(19) << formatTimestamp(itinerary.departs)
+                     << setw(19) << formatTimestamp(itinerary.arrives)
+                     << setw(7) << (itinerary.legs.size() - 1)
+                     << setw(12) << formatFare(itinerary.totalFare)
+                     << legs << endl;
+            }
+            
+            int selection;
+            cout << "\nEnter itinerary to book (1-" << itineraries.size() << "): ";
+            cin >> selection;
+            
+            if(selection < 1 || selection > static_cast<int>(itineraries.size())) {
+                cout << "\nInvalid selection!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
+            const Itinerary& itinerary = itineraries[selection - 1];
+            vector<int> seats;
+            vector<uint64_t> holds;
+            auto releaseHolds = [&]() {
+                for(uint64_t token : holds) releaseHold(token);
+            };
+            for(const auto& leg : itinerary.legs) {
+                displaySeatMap(*leg.flight);
                 
-                cout << "\nECONOMY CLASS:\n";
-                cout << "---------------------------\n";
-                for(int i = 1; i <= 30; i++) {
-                    bool isAvailable = flight.isSeatAvailable(i);
-                    cout << "[" << (isAvailable ? " " : "X") << "] " << (i < 10 ? " " : "") << i << "\t";
-                    if(i % 6 == 0) cout << endl;
+                int seatNumber;
+                uint64_t holdToken;
+                cout << "\nEnter seat number to book on flight " << leg.flight->flightNumber << ": ";
+                cin >> seatNumber;
+                if(holdSeat(leg.flight->flightNumber, seatNumber, SEAT_HOLD_SECONDS, holdToken) != HELD) {
+                    releaseHolds();
+                    cout << "\nThis seat is not available.\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
+                }
+                seats.push_back(seatNumber);
+                holds.push_back(holdToken);
+            }
+            cout << "Seats are held for you for " << SEAT_HOLD_SECONDS / 60 << " minutes.\n";
+            
+            cin.ignore();
+            string name, email, phone;
+            
+            cout << "\nEnter passenger details:\n";
+            cout << "Name: ";
+            getline(cin, name);
+            
+            cout << "Email: ";
+            getline(cin, email);
+            
+            cout << "Phone: ";
+            getline(cin, phone);
+            
+            double totalPrice = 0;
+            cout << "\nBooking Summary:\n";
+            for(size_t i = 0; i < itinerary.legs.size(); i++) {
+                const Flight& flight = *itinerary.legs[i].flight;
+                double seatPrice = fareCurve->quoteSeat(flight, seats[i]);
+                totalPrice += seatPrice;
+                cout << "Flight " << flight.flightNumber << ": " << flight.sourceName() << " to " << flight.destinationName()
+                     << ", " << flight.date << " " << flight.sourceTime << "-" << flight.destinationTime
+                     << ", Seat " << seats[i] << " (" << flight.getSeatType(seats[i]) << "), Rs. "
+                     << formatFare(seatPrice) << endl;
+            }
+            cout << "Total: Rs. " << formatFare(totalPrice) << endl;
+            
+            cout << "\nConfirm booking? (Y/N): ";
+            char confirm;
+            cin >> confirm;
+            
+            if(toupper(confirm) != 'Y') {
+                releaseHolds();
+                cout << "\nBooking canceled.\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
+            // Every leg or none - a leg that fails releases the ones already booked
+            vector<string> tickets;
+            for(size_t i = 0; i < itinerary.legs.size(); i++) {
+                Passenger booked;
+                double price;
+                BookingResult result = bookHeldSeat(holds[i], name, email, phone, booked, price);
+                if(result != BOOKED) {
+                    for(const auto& ticketNumber : tickets) cancelBooking(ticketNumber);
+                    releaseHolds();
+                    cout << "\nBooking failed on flight " << itinerary.legs[i].flight->flightNumber << ": "
+                         << bookingResultMessage(result) << ".\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
+                }
+                tickets.push_back(booked.ticketNumber);
+            }
+            
+            cout << "\nBooking successful!\n";
+            for(const auto& ticketNumber : tickets) {
+                if(issueTicket(ticketNumber)) {
+                    cout << "Ticket " << ticketNumber << " has been saved to " << TICKET_ARCHIVE_FILE << ".\n";
+                } else {
+                    cout << "Ticket " << ticketNumber << " could not be saved. Use Reprint Ticket to retry.\n";
+                }
+            }
+            cout << "Press any key to continue...";
+            getch();
+        }
+        // Seats left and the lowest fare on a route for each day of a month
+        void viewFareCalendar() {
+            displayTitle();
+            cout << "FARE CALENDAR\n\n";
+            
+            cin.ignore();
+            string source, destination, monthStr;
+            cout << "Source: ";
+            getline(cin, source);
+            
+            cout << "Destination: ";
+            getline(cin, destination);
+            
+            cout << "Month (MM/YYYY): ";
+            getline(cin, monthStr);
+            
+            int month = 0, year = 0;
+            char slash = 0;
+            stringstream monthIn(monthStr);
+            if(!(monthIn >> month >> slash >> year) || slash != '/' || month < 1 || month > 12) {
+                cout << "\nInvalid month!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
+            cout << "\n" << left << setw(15) << "Date"
+                 << setw(10) << "Flights"
+                 << setw(12) << "Seats Left"
+                 << "Fare From" << endl;
+            cout << string(49, '-') << endl;
+            for(const auto& day : routeMonth(source, destination, year, month)) {
+                if(day.flights == 0) continue;
+                cout << left << setw(15) << day.date
+                     << setw(10) << day.flights
+                     << setw(12) << day.seatsLeft
+                     << (day.lowestFare > 0 ? formatFare(day.lowestFare) : "Full") << endl;
+            }
+            cout << "\nPress any key to continue...";
+            getch();
+        }
+        
+        // Seats for a family or tour party on one flight, all booked together
+        void bookGroupTickets() {
+            displayTitle();
+            cout << "BOOK GROUP TICKETS\n\n";
+            
+            cin.ignore();
+            GroupBooking group;
+            cout << "Flight Number: ";
+            getline(cin, group.flightNumber);
+            
+            Flight* flight = findFlight(group.flightNumber);
+            if(!flight || flight->status == CANCELED) {
+                cout << "\nFlight not found or canceled!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
+            string classStr;
+            cout << "Class (Economy, Premium Economy, Business, First; blank for any): ";
+            getline(cin, classStr);
+            if(!classStr.empty()) {
+                if(!parseSeatClass(classStr, group.seatClass)) {
+                    cout << "\nUnknown seat class!\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
                 }
+                group.anyClass = false;
+            }
+            
+            int size;
+            cout << "Number of passengers (1-" << MAX_GROUP_SIZE << "): ";
+            cin >> size;
+            if(size < 1 || size > MAX_GROUP_SIZE) {
+                cout << "\nInvalid group size!\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
+            cin.ignore();
+            for(int i = 0; i < size; i++) {
+                Passenger member;
+                cout << "\nPassenger " << (i + 1) << ":\n";
+                cout << "Name: ";
+                getline(cin, member.name);
+                
+                cout << "Email: ";
+                getline(cin, member.email);
                 
-                cout << "\nLegend: [ ] - Available  [X] - Booked\n";
+                cout << "Phone: ";
+                getline(cin, member.phone);
+                group.party.push_back(member);
+            }
+            
+            cout << "\nBook " << size << " seats on flight " << flight->flightNumber << "? (Y/N): ";
+            char confirm;
+            cin >> confirm;
+            
+            if(toupper(confirm) != 'Y') {
+                cout << "\nBooking canceled.\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
+            }
+            
+            BookingResult result = bookGroup(group);
+            if(result != BOOKED) {
+                cout << "\nGroup booking failed: " << bookingResultMessage(result) << ". No seats were booked.\n";
+                cout << "Press any key to continue...";
+                getch();
+                return;
             }
             
-            void generateTicket(const Flight& flight, const Passenger& passenger) {
-                // Generate ticket file
-                string filename = "ticket_" + passenger.ticketNumber + ".txt";
-                ofstream ticketFile(filename);
+            cout << "\nBooking successful! "
+                 << (group.adjacent ? "The group sits together.\n" : "No run of adjacent seats was free, so the group is split up.\n");
+            for(size_t i = 0; i < group.party.size(); i++) {
+                const Passenger& member = group.party[i];
+                cout << "Ticket " << member.ticketNumber << ": " << member.name << ", Seat " << member.seatNumber
+                     << " (" << flight->getSeatType(member.seatNumber) << "), Rs. " << formatFare(group.fares[i]);
+                cout << (issueTicket(member.ticketNumber) ? "" : " - not saved, use Reprint Ticket") << endl;
+            }
+            cout << "Total: Rs. " << formatFare(group.totalFare) << endl;
+            cout << "Press any key to continue...";
+            getch();
+        }
+        
+            void displaySeatMap(const Flight& flight) {
+                displayTitle();
+                cout << "SEAT MAP - Flight " << flight.flightNumber << "\n\n";
                 
-                if(!ticketFile.is_open()) {
-                    cout << "\nError: Could not generate ticket file!\n";
-                    return;
+                // Cabins from the front of the aircraft, one line per seat row,
+                // each headed by its current fare
+                const SeatLayout& layout = *flight.layout;
+                FlightQuote quote = quoteFlight(flight);
+                vector<const Cabin*> cabins;
+                for(const auto& cabin : layout.cabins) {
+                    cabins.push_back(&cabin);
                 }
+                stable_sort(cabins.begin(), cabins.end(), [](const Cabin* a, const Cabin* b) {
+                    return seatClassRank(a->type) < seatClassRank(b->type);
+                });
                 
-                ticketFile << "=============================================\n";
-                ticketFile << "            HAWAII JAHAJH DE TICKET          \n";
-                ticketFile << "=============================================\n\n";
-                ticketFile << "TICKET NUMBER: " << passenger.ticketNumber << "\n\n";
-                ticketFile << "PASSENGER INFORMATION:\n";
-                ticketFile << "Name: " << passenger.name << "\n";
-                ticketFile << "Phone: " << passenger.phone << "\n";
-                ticketFile << "Email: " << passenger.email << "\n\n";
-                ticketFile << "FLIGHT INFORMATION:\n";
-                ticketFile << "Flight Number: " << flight.flightNumber << "\n";
-                ticketFile << "From: " << flight.source << "\n";
-                ticketFile << "To: " << flight.destination << "\n";
-                if(!flight.via.empty()) {
-                    ticketFile << "Via: " << flight.via << "\n";
+                for(const Cabin* cabin : cabins) {
+                    string className = seatClassName(cabin->type);
+                    transform(className.begin(), className.end(), className.begin(), ::toupper);
+                    cout << className << " CLASS - Rs. " << formatFare(quote.cabinFares[cabin - layout.cabins.data()]) << ":\n";
+                    cout << "---------------------------\n";
+                    
+                    int lastSeat = cabin->firstSeat + cabin->seatCount - 1;
+                    for(int rowStart = cabin->firstSeat; rowStart <= lastSeat; rowStart += cabin->seatsPerRow) {
+                        cout << "Row " << right << setw(2) << layout.seatTable[rowStart].row << "  ";
+                        
+                        int seatNum = rowStart;
+                        for(size_t b = 0; b < cabin->blocks.size() && seatNum <= lastSeat; b++) {
+                            if(b) cout << "   ";
+                            for(int i = 0; i < cabin->blocks[b] && seatNum <= lastSeat; i++, seatNum++) {
+                                char mark = flight.isSeatBooked(seatNum) ? 'X' : (flight.isSeatHeld(seatNum) ? 'H' : ' ');
+                                cout << "[" << mark << "]" << setw(3) << seatNum << " ";
+                            }
+                        }
+                        cout << endl;
+                    }
+                    cout << endl;
                 }
-                ticketFile << "Date: " << flight.date << "\n";
-                ticketFile << "Departure Time: " << flight.sourceTime << "\n";
-                ticketFile << "Arrival Time: " << flight.destinationTime << "\n";
-                ticketFile << "Seat Number: " << passenger.seatNumber << " (" << flight.getSeatType(passenger.seatNumber) << ")\n\n";
-                ticketFile << "=============================================\n";
-                ticketFile << "         THANK YOU FOR FLYING WITH US!       \n";
-                ticketFile << "=============================================\n";
                 
-                ticketFile.close();
-                
-                cout << "\nTicket saved as " << filename << endl;
+                cout << left << "Legend: [ ] - Available  [X] - Booked  [H] - On hold\n";
             }
             
             void viewFlightSchedule() {
@@ -1093,39 +7017,48 @@ public:
                 cout << "Search Filters (leave blank to show all):\n";
                 cin.ignore();
                 
-                string sourceFilter, destFilter, dateFilter;
-                double maxPrice = -1;
+                ScheduleQuery query;
+                string fromFilter, toFilter, earliestFilter, latestFilter;
                 
                 cout << "Source: ";
-                getline(cin, sourceFilter);
+                getline(cin, query.source);
                 
                 cout << "Destination: ";
-                getline(cin, destFilter);
+                getline(cin, query.destination);
                 
-                cout << "Date (DD/MM/YYYY): ";
-                getline(cin, dateFilter);
+                cout << "From Date (DD/MM/YYYY): ";
+                getline(cin, fromFilter);
+                
+                cout << "To Date (DD/MM/YYYY, blank for the From Date only): ";
+                getline(cin, toFilter);
+                
+                cout << "Departing after (HH:MM): ";
+                getline(cin, earliestFilter);
+                
+                cout << "Departing before (HH:MM): ";
+                getline(cin, latestFilter);
                 
                 string priceFilterStr;
                 cout << "Max Price (leave blank for no limit): ";
                 getline(cin, priceFilterStr);
                 
-                if(!priceFilterStr.empty()) {
-                    maxPrice = stod(priceFilterStr);
+                if((!fromFilter.empty() && !FlightDate::parse(fromFilter, query.fromDate)) ||
+                   (!toFilter.empty() && !FlightDate::parse(toFilter, query.toDate)) ||
+                   (!earliestFilter.empty() && !FlightTime::parse(earliestFilter, query.earliest)) ||
+                   (!latestFilter.empty() && !FlightTime::parse(latestFilter, query.latest))) {
+                    cout << "\nInvalid date or time.\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
                 }
+                if(toFilter.empty()) query.toDate = query.fromDate;
                 
-                vector<Flight*> filteredFlights;
-                
-                for(auto& flight : flights) {
-                    bool matchesSource = sourceFilter.empty() || flight.source == sourceFilter;
-                    bool matchesDest = destFilter.empty() || flight.destination == destFilter;
-                    bool matchesDate = dateFilter.empty() || flight.date == dateFilter;
-                    bool matchesPrice = maxPrice < 0 || flight.basePrice <= maxPrice;
-                    
-                    if(matchesSource && matchesDest && matchesDate && matchesPrice) {
-                        filteredFlights.push_back(&flight);
-                    }
+                if(!priceFilterStr.empty()) {
+                    query.maxPrice = stod(priceFilterStr);
                 }
                 
+                vector<FlightQuote> filteredFlights = quoteSchedule(query);
+                
                 if(filteredFlights.empty()) {
                     cout << "\nNo flights match your search criteria.\n";
                     cout << "Press any key to continue...";
@@ -1140,10 +7073,12 @@ public:
                      << setw(10) << "Date" 
                      << setw(10) << "Time" 
                      << setw(10) << "Price" 
+                     << setw(12) << "Fare From" 
                      << setw(10) << "Status" << endl;
-                cout << string(80, '-') << endl;
+                cout << string(92, '-') << endl;
                 
-                for(const auto& flight : filteredFlights) {
+                for(const auto& quote : filteredFlights) {
+                    const Flight* flight = quote.flight;
                     string statusStr;
                     switch(flight->status) {
                         case ON_TIME: statusStr = "On Time"; break;
@@ -1152,11 +7087,12 @@ public:
                     }
                     
                     cout << left << setw(10) << flight->flightNumber 
-                         << setw(15) << flight->source 
-                         << setw(15) << flight->destination 
+                         << setw(15) << flight->sourceName() 
+                         << setw(15) << flight->destinationName() 
                          << setw(10) << flight->date 
                          << setw(10) << flight->sourceTime 
                          << setw(10) << flight->basePrice 
+                         << setw(12) << (quote.lowestFare > 0 ? formatFare(quote.lowestFare) : "N/A") 
                          << setw(10) << statusStr << endl;
                 }
                 
@@ -1172,47 +7108,40 @@ public:
                 cout << "Enter Ticket Number: ";
                 cin >> ticketNumber;
                 
-                for(auto& flight : flights) {
-                    for(auto it = flight.passengers.begin(); it != flight.passengers.end(); ++it) {
-                        if(it->ticketNumber == ticketNumber) {
-                            // Confirm cancellation
-                            cout << "\nTicket Details:\n";
-                            cout << "Passenger: " << it->name << endl;
-                            cout << "Flight: " << flight.flightNumber << " (" << flight.source << " to " << flight.destination << ")" << endl;
-                            cout << "Date: " << flight.date << endl;
-                            cout << "Seat: " << it->seatNumber << endl;
-                            
-                            cout << "\nAre you sure you want to cancel this ticket? (Y/N): ";
-                            char confirm;
-                            cin >> confirm;
-                            
-                            if(toupper(confirm) != 'Y') {
-                                cout << "\nCancellation aborted.\n";
-                                cout << "Press any key to continue...";
-                                getch();
-                                return;
-                            }
-                            
-                            // Remove from booking history
-                            if(bookingHistory.find(it->phone) != bookingHistory.end()) {
-                                auto& tickets = bookingHistory[it->phone];
-                                tickets.erase(remove(tickets.begin(), tickets.end(), ticketNumber), tickets.end());
-                            }
-                            
-                            // Free up the seat
-                            flight.markSeatAvailable(it->seatNumber);
-                            
-                            // Remove passenger
-                            flight.passengers.erase(it);
-                            
-                            saveData();
-                            
-                            cout << "\nTicket canceled successfully!\n";
-                            cout << "Press any key to continue...";
-                            getch();
-                            return;
-                        }
+                TicketHandle handle;
+                if(findTicket(ticketNumber, handle)) {
+                    const Flight& flight = flights[handle.flight];
+                    Passenger passenger = passengerStore.get(flight.passengers[handle.passenger]);
+                    
+                    // Confirm cancellation
+                    cout << "\nTicket Details:\n";
+                    cout << "Passenger: " << passenger.name << endl;
+                    cout << "Flight: " << flight.flightNumber << " (" << flight.sourceName() << " to " << flight.destinationName() << ")" << endl;
+                    cout << "Date: " << flight.date << endl;
+                    cout << "Seat: " << passenger.seatNumber << endl;
+                    
+                    cout << "\nAre you sure you want to cancel this ticket? (Y/N): ";
+                    char confirm;
+                    cin >> confirm;
+                    
+                    if(toupper(confirm) != 'Y') {
+                        cout << "\nCancellation aborted.\n";
+                        cout << "Press any key to continue...";
+                        getch();
+                        return;
                     }
+                    
+                    // Remove from booking history, free up the seat and remove passenger
+                    string promotedTicket;
+                    cancelBooking(ticketNumber, promotedTicket);
+                    
+                    cout << "\nTicket canceled successfully!\n";
+                    if(!promotedTicket.empty()) {
+                        cout << "The seat has gone to a waitlisted passenger, ticket " << promotedTicket << ".\n";
+                    }
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
                 }
                 
                 cout << "\nTicket not found!\n";
@@ -1228,7 +7157,8 @@ public:
                 cout << "Enter Phone Number: ";
                 cin >> phone;
                 
-                if(bookingHistory.find(phone) == bookingHistory.end() || bookingHistory[phone].empty()) {
+                vector<BookingHistoryEntry> history = bookingHistoryOf(phone);
+                if(history.empty()) {
                     cout << "\nNo booking history found for this phone number.\n";
                     cout << "Press any key to continue...";
                     getch();
@@ -1244,41 +7174,19 @@ public:
                      << setw(10) << "Status" << endl;
                 cout << string(60, '-') << endl;
                 
-                for(const auto& ticketNum : bookingHistory[phone]) {
-                    bool found = false;
-                    
-                    for(const auto& flight : flights) {
-                        for(const auto& passenger : flight.passengers) {
-                            if(passenger.ticketNumber == ticketNum) {
-                                found = true;
-                                
-                                string statusStr;
-                                switch(flight.status) {
-                                    case ON_TIME: statusStr = "On Time"; break;
-                                    case DELAYED: statusStr = "Delayed"; break;
-                                    case CANCELED: statusStr = "Canceled"; break;
-                                }
-                                
-                                cout << left << setw(15) << ticketNum 
-                                     << setw(10) << flight.flightNumber 
-                                     << setw(15) << (flight.source + "-" + flight.destination) 
-                                     << setw(10) << flight.date 
-                                     << setw(10) << statusStr << endl;
-                                
-                                break;
-                            }
-                        }
-                        
-                        if(found) break;
+                for(const auto& entry : history) {
+                    string statusStr;
+                    switch(entry.status) {
+                        case ON_TIME: statusStr = "On Time"; break;
+                        case DELAYED: statusStr = "Delayed"; break;
+                        case CANCELED: statusStr = "Canceled"; break;
                     }
                     
-                    if(!found) {
-                        cout << left << setw(15) << ticketNum 
-                             << setw(10) << "N/A" 
-                             << setw(15) << "N/A" 
-                             << setw(10) << "N/A" 
-                             << setw(10) << "Canceled" << endl;
-                    }
+                    cout << left << setw(15) << entry.ticketNumber 
+                         << setw(10) << entry.flightNumber 
+                         << setw(15) << (entry.source + "-" + entry.destination) 
+                         << setw(10) << entry.date 
+                         << setw(10) << statusStr << endl;
                 }
                 
                 cout << "\nPress any key to continue...";
@@ -1293,16 +7201,13 @@ public:
                 cout << "Enter Ticket Number: ";
                 cin >> ticketNumber;
                 
-                for(const auto& flight : flights) {
-                    for(const auto& passenger : flight.passengers) {
-                        if(passenger.ticketNumber == ticketNumber) {
-                            generateTicket(flight, passenger);
-                            cout << "\nTicket has been reprinted.\n";
-                            cout << "Press any key to continue...";
-                            getch();
-                            return;
-                        }
-                    }
+                string text;
+                if(ticketText(ticketNumber, text)) {
+                    cout << "\n" << text;
+                    cout << "\nTicket has been reprinted.\n";
+                    cout << "Press any key to continue...";
+                    getch();
+                    return;
                 }
                 
                 cout << "\nTicket not found!\n";
@@ -1311,8 +7216,891 @@ public:
             }
         };
         
-        int main() {
+        // Keeps benchmarked work from being optimized away
+        volatile size_t benchmarkSink;
+        
+        // Microbenchmark - ticket lookup latency for index sizes from 1k up to maxPassengers
+        void benchmarkTicketIndex(size_t maxPassengers) {
+            const size_t lookups = 1000000;
+            mt19937_64 rng(42);
+            
+            cout << left << setw(12) << "Passengers"
+                 << setw(14) << "Build (ms)"
+                 << setw(14) << "Hit (ns)"
+                 << setw(14) << "Miss (ns)" << endl;
+            cout << string(54, '-') << endl;
+            
+            for(size_t count = 1000; count <= maxPassengers; count *= 10) {
+                TicketIndex index;
+                index.reserve(count);
+                
+                auto buildStart = chrono::steady_clock::now();
+                for(size_t i = 0; i < count; i++) {
+                    index.insert("TKT" + to_string(10000000 + i), TicketHandle{i / 40, i % 40});
+                }
+                auto buildEnd = chrono::steady_clock::now();
+                
+                vector<string> hits, misses;
+                hits.reserve(lookups);
+                misses.reserve(lookups);
+                for(size_t i = 0; i < lookups; i++) {
+                    hits.push_back("TKT" + to_string(10000000 + rng() % count));
+                    misses.push_back("TKX" + to_string(10000000 + rng() % count));
+                }
+                
+                size_t checksum = 0;
+                auto hitStart = chrono::steady_clock::now();
+                for(const auto& ticket : hits) {
+                    TicketHandle handle;
+                    if(index.find(ticket, handle)) checksum += handle.passenger;
+                }
+                auto hitEnd = chrono::steady_clock::now();
+                
+                for(const auto& ticket : misses) {
+                    checksum += index.contains(ticket);
+                }
+                auto missEnd = chrono::steady_clock::now();
+                
+                double buildMs = chrono::duration<double, milli>(buildEnd - buildStart).count();
+                double hitNs = chrono::duration<double, nano>(hitEnd - hitStart).count() / lookups;
+                double missNs = chrono::duration<double, nano>(missEnd - hitEnd).count() / lookups;
+                
+                cout << left << setw(12) << count
+                     << setw(14) << fixed << setprecision(1) << buildMs
+                     << setw(14) << hitNs
+                     << setw(14) << missNs << endl;
+                
+                benchmarkSink = checksum;
+            }
+        }
+        
+        // Stress test - booking agents on 1, 2, 4, ... up to maxThreads threads book random
+        // seats on random flights and cancel about one booking in ten. Each round starts
+        // from an empty in-memory schedule and ends with a full consistency check.
+        // Returns false if any round finds a double-booked seat or a broken index.
+        bool runStressTest(unsigned maxThreads, int flightCount, int attemptsPerThread) {
+            const SeatLayout* layout = seatLayouts().find("A320");
+            bool consistent = true;
+            
+            cout << left << setw(10) << "Threads"
+                 << setw(14) << "Time (ms)"
+                 << setw(14) << "Ops/s"
+                 << setw(12) << "Booked"
+                 << setw(12) << "Canceled"
+                 << setw(12) << "Taken"
+                 << setw(10) << "Problems" << endl;
+            cout << string(84, '-') << endl;
+            
+            for(unsigned threadCount = 1; ; threadCount = min(threadCount * 2, maxThreads)) {
+                FlightBookingSystem system(false);
+                for(int i = 0; i < flightCount; i++) {
+                    Flight flight("ST" + to_string(1000 + i), "DEL", "BOM", "08:00", "10:00",
+                                  "01/01/2025", 5000, "None", 0);
+                    flight.setLayout(layout);
+                    system.addNewFlight(flight);
+                }
+                
+                atomic<long long> booked(0), canceled(0), taken(0);
+                vector<thread> agents;
+                auto start = chrono::steady_clock::now();
+                
+                for(unsigned t = 0; t < threadCount; t++) {
+                    agents.emplace_back([&, t]() {
+                        mt19937_64 rng(1000 + t);
+                        vector<string> myTickets;
+                        long long myBooked = 0, myCanceled = 0, myTaken = 0;
+                        
+                        for(int i = 0; i < attemptsPerThread; i++) {
+                            if(!myTickets.empty() && rng() % 10 == 0) {
+                                size_t pick = rng() % myTickets.size();
+                                if(system.cancelBooking(myTickets[pick])) myCanceled++;
+                                myTickets[pick] = myTickets.back();
+                                myTickets.pop_back();
+                                continue;
+                            }
+                            
+                            string flightNumber = "ST" + to_string(1000 + rng() % flightCount);
+                            int seatNumber = 1 + rng() % layout->seatCount;
+                            string phone = to_string(t) + "-" + to_string(i);
+                            
+                            Passenger passenger;
+                            double price;
+                            BookingResult result = system.bookSeat(flightNumber, seatNumber, "Agent " + to_string(t),
+                                                                   "agent@example.com", phone, passenger, price);
+                            if(result == BOOKED) {
+                                myBooked++;
+                                myTickets.push_back(passenger.ticketNumber);
+                            } else if(result == SEAT_TAKEN) {
+                                myTaken++;
+                            }
+                        }
+                        
+                        booked += myBooked;
+                        canceled += myCanceled;
+                        taken += myTaken;
+                    });
+                }
+                for(auto& agent : agents) agent.join();
+                
+                double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                double opsPerSecond = threadCount * static_cast<double>(attemptsPerThread) / (elapsedMs / 1000.0);
+                size_t problems = system.verifyInventory(cerr);
+                if(problems > 0) consistent = false;
+                
+                cout << left << setw(10) << threadCount
+                     << setw(14) << fixed << setprecision(1) << elapsedMs
+                     << setw(14) << setprecision(0) << opsPerSecond
+                     << setw(12) << booked.load()
+                     << setw(12) << canceled.load()
+                     << setw(12) << taken.load()
+                     << setw(10) << problems << endl;
+                
+                if(threadCount >= maxThreads) break;
+            }
+            
+            cout << (consistent ? "No double-booked seats." : "INCONSISTENT INVENTORY DETECTED!") << endl;
+            return consistent;
+        }
+        
+        // Per-operation latencies collected by the benchmark suite
+        struct LatencySamples {
+            vector<double> nanos;
+            
+            void add(chrono::steady_clock::time_point start) {
+                nanos.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+            }
+            
+            double percentile(double fraction) const {
+                vector<double> sorted = nanos;
+                sort(sorted.begin(), sorted.end());
+                size_t rank = min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+                return sorted[rank];
+            }
+            
+            double total() const {
+                double sum = 0;
+                for(double sample : nanos) sum += sample;
+                return sum;
+            }
+        };
+        
+        void writeBenchResult(ostream& out, const string& operation, const LatencySamples& samples, bool last) {
+            out << "    {\"operation\": \"" << operation << "\", "
+                << "\"ops\": " << samples.nanos.size() << ", "
+                << fixed << setprecision(0)
+                << "\"opsPerSec\": " << samples.nanos.size() / (samples.total() / 1e9) << ", "
+                << "\"p50Ns\": " << samples.percentile(0.50) << ", "
+                << "\"p99Ns\": " << samples.percentile(0.99) << "}"
+                << (last ? "\n" : ",\n");
+        }
+        
+        // Benchmark suite - builds a schedule of flightCount flights with passengersPerFlight
+        // passengers each, historySize tickets per phone number, and times loading, saving,
+        // searching, booking, cancelling and history lookups. Data files are written in
+        // workDir so real data is never touched. Results are printed as JSON.
+        bool runBenchmarks(int flightCount, int passengersPerFlight, int historySize, const string& workDir) {
+            static const char* cities[] = {
+                "Delhi", "Mumbai", "Bangalore", "Chennai", "Kolkata", "Hyderabad", "Pune",
+                "Ahmedabad", "Jaipur", "Lucknow", "Goa", "Kochi", "Guwahati", "Patna",
+                "Bhopal", "Indore", "Nagpur", "Srinagar", "Amritsar", "Varanasi"
+            };
+            const int cityCount = sizeof(cities) / sizeof(cities[0]);
+            const int dayCount = 28;
+            const int iterations = 5;
+            const int lookups = 100000;
+            
+#ifdef _WIN32
+            _mkdir(workDir.c_str());
+            if(_chdir(workDir.c_str()) != 0) {
+#else
+            mkdir(workDir.c_str(), 0755);
+            if(chdir(workDir.c_str()) != 0) {
+#endif
+                cerr << "Cannot use benchmark directory " << workDir << endl;
+                return false;
+            }
+            FlightBookingSystem::removeDataFiles();
+            
+            // Smallest built-in aircraft that leaves room for the booking benchmark
+            const SeatLayout* layout = nullptr;
+            for(const auto& candidate : seatLayouts().all()) {
+                if(candidate.seatCount > passengersPerFlight && (!layout || candidate.seatCount < layout->seatCount)) {
+                    layout = &candidate;
+                }
+            }
+            if(!layout) {
+                layout = seatLayouts().find("B777");
+                passengersPerFlight = layout->seatCount - 1;
+            }
+            historySize = max(1, historySize);
+            
+            mt19937_64 rng(42);
+            auto flightNumberOf = [](int i) { return "BF" + to_string(100000 + i); };
+            auto dateOf = [](int day) {
+                stringstream ss;
+                ss << setfill('0') << setw(2) << day + 1 << "/01/2025";
+                return ss.str();
+            };
+            auto phoneOf = [](long long holder) { return to_string(9000000000LL + holder); };
+            
+            // Build the dataset in memory and write it as the starting snapshot
+            long long passengerTotal = 0;
+            uint64_t fullSnapshotBytes = 0;
+            double checkpointBytes = 0;
+            {
+                FlightBookingSystem builder(false);
+                for(int i = 0; i < flightCount; i++) {
+                    int source = i % cityCount;
+                    int destination = (source + 1 + (i / cityCount) % (cityCount - 1)) % cityCount;
+                    Flight flight(flightNumberOf(i), cities[source], cities[destination], "08:00", "10:30",
+                                  dateOf((i / (cityCount * (cityCount - 1))) % dayCount), 4500, "None", 0);
+                    flight.setLayout(layout);
+                    builder.addNewFlight(flight);
+                    
+                    for(int seat = 1; seat <= passengersPerFlight; seat++) {
+                        Passenger passenger;
+                        double price;
+                        builder.bookSeat(flight.flightNumber, seat, "Passenger " + to_string(passengerTotal),
+                                         "passenger@example.com", phoneOf(passengerTotal / historySize),
+                                         passenger, price);
+                        passengerTotal++;
+                    }
+                }
+                if(!builder.saveSnapshot()) return false;
+                
+                LatencySamples save;
+                for(int i = 0; i < iterations; i++) {
+                    uint64_t written = builder.persistenceStatistics().checkpointBytes;
+                    auto start = chrono::steady_clock::now();
+                    builder.saveSnapshot(true);
+                    save.add(start);
+                    fullSnapshotBytes = builder.persistenceStatistics().checkpointBytes - written;
+                }
+                
+                // Checkpoints after a single booking or cancellation write only what it touched
+                LatencySamples incremental;
+                uint64_t written = builder.persistenceStatistics().checkpointBytes;
+                for(int i = 0; i < lookups / 1000; i++) {
+                    Passenger passenger;
+                    double price;
+                    builder.bookSeat(flightNumberOf(rng() % flightCount), passengersPerFlight + 1, "Checkpoint",
+                                     "bench@example.com", phoneOf(passengerTotal), passenger, price);
+                    auto start = chrono::steady_clock::now();
+                    builder.saveSnapshot();
+                    incremental.add(start);
+                    
+                    builder.cancelBooking(passenger.ticketNumber);
+                    start = chrono::steady_clock::now();
+                    builder.saveSnapshot();
+                    incremental.add(start);
+                }
+                checkpointBytes = static_cast<double>(builder.persistenceStatistics().checkpointBytes - written) /
+                                  incremental.nanos.size();
+                
+                cout << "{\n";
+                cout << "  \"parameters\": {\"flights\": " << flightCount
+                     << ", \"passengersPerFlight\": " << passengersPerFlight
+                     << ", \"historySize\": " << historySize
+                     << ", \"layout\": \"" << layout->id << "\"},\n";
+                cout << "  \"results\": [\n";
+                writeBenchResult(cout, "save", save, false);
+                writeBenchResult(cout, "checkpoint", incremental, false);
+            }
+            
+            LatencySamples load;
+            for(int i = 0; i < iterations; i++) {
+                auto start = chrono::steady_clock::now();
+                FlightBookingSystem loaded;
+                load.add(start);
+            }
+            writeBenchResult(cout, "load", load, false);
+            
+            // Bookings are acknowledged once queued, as in a front end that does
+            // not wait for the disk; book-sync below waits for each fsync
+            FlightBookingSystem system;
+            system.setDurabilityPolicy(ASYNC_COMMIT);
+            
+            LatencySamples search;
+            size_t found = 0;
+            for(int i = 0; i < lookups; i++) {
+                int source = rng() % cityCount;
+                int destination = (source + 1 + rng() % (cityCount - 1)) % cityCount;
+                auto start = chrono::steady_clock::now();
+                found += system.searchFlights(cities[source], cities[destination], dateOf(rng() % dayCount), -1).size();
+                search.add(start);
+            }
+            writeBenchResult(cout, "search", search, false);
+            
+            // Fares for every flight on a route and for every seat of a flight
+            LatencySamples quoteRoute;
+            for(int i = 0; i < lookups; i++) {
+                ScheduleQuery query;
+                int source = rng() % cityCount;
+                query.source = cities[source];
+                query.destination = cities[(source + 1 + rng() % (cityCount - 1)) % cityCount];
+                auto start = chrono::steady_clock::now();
+                found += system.quoteSchedule(query).size();
+                quoteRoute.add(start);
+            }
+            writeBenchResult(cout, "quote-route", quoteRoute, false);
+            
+            LatencySamples quoteSeats;
+            SeatMapQuote seatMap;
+            for(int i = 0; i < lookups; i++) {
+                auto start = chrono::steady_clock::now();
+                found += system.quoteSeatMap(flightNumberOf(rng() % flightCount), seatMap);
+                quoteSeats.add(start);
+            }
+            writeBenchResult(cout, "quote-seats", quoteSeats, false);
+            
+            // A month of seats left and lowest fares on a route, from the route calendars
+            LatencySamples availability;
+            for(int i = 0; i < lookups; i++) {
+                int source = rng() % cityCount;
+                int destination = (source + 1 + rng() % (cityCount - 1)) % cityCount;
+                auto start = chrono::steady_clock::now();
+                found += system.routeMonth(cities[source], cities[destination], 2025, 1).size();
+                availability.add(start);
+            }
+            writeBenchResult(cout, "availability-month", availability, false);
+            
+            // Itineraries of up to three flights, by arrival and by fare. The
+            // route graph is built by the first search, outside the samples.
+            LatencySamples connect;
+            ConnectionQuery connection;
+            connection.source = cities[0];
+            connection.destination = cities[1];
+            found += system.searchConnections(connection).size();
+            for(int i = 0; i < lookups / 100; i++) {
+                int source = rng() % cityCount;
+                connection.source = cities[source];
+                connection.destination = cities[(source + 1 + rng() % (cityCount - 1)) % cityCount];
+                FlightDate::parse(dateOf(rng() % dayCount), connection.fromDate);
+                connection.toDate = connection.fromDate;
+                connection.order = (i % 2) ? LOWEST_FARE : EARLIEST_ARRIVAL;
+                auto start = chrono::steady_clock::now();
+                found += system.searchConnections(connection).size();
+                connect.add(start);
+            }
+            writeBenchResult(cout, "connections", connect, false);
+            
+            // Seat holds taken and given back, then a wheel the size of a busy
+            // day's holds expiring tick by tick
+            LatencySamples hold, release;
+            for(int i = 0; i < lookups; i++) {
+                uint64_t token;
+                auto start = chrono::steady_clock::now();
+                system.holdSeat(flightNumberOf(rng() % flightCount), passengersPerFlight + 1, SEAT_HOLD_SECONDS, token);
+                hold.add(start);
+                
+                start = chrono::steady_clock::now();
+                system.releaseHold(token);
+                release.add(start);
+            }
+            writeBenchResult(cout, "hold", hold, false);
+            writeBenchResult(cout, "release", release, false);
+            
+            LatencySamples expire;
+            TimingWheel wheel;
+            const uint64_t expireTicks = 3000;
+            for(int i = 0; i < lookups * 10; i++) wheel.schedule(1 + rng() % expireTicks, i);
+            size_t expired = 0;
+            for(uint64_t tick = 1; tick <= expireTicks; tick++) {
+                auto start = chrono::steady_clock::now();
+                wheel.advance(tick, [&](uint64_t, uint64_t) { expired++; });
+                expire.add(start);
+            }
+            found += expired;
+            writeBenchResult(cout, "hold-expire", expire, false);
+            
+            // Fill the free seats flight by flight, then cancel those bookings
+            int bookings = static_cast<int>(min<long long>(lookups, 1LL * flightCount * (layout->seatCount - passengersPerFlight)));
+            vector<string> booked;
+            booked.reserve(bookings);
+            
+            LatencySamples book;
+            for(int i = 0; i < bookings; i++) {
+                Passenger passenger;
+                double price;
+                auto start = chrono::steady_clock::now();
+                BookingResult result = system.bookSeat(flightNumberOf(i % flightCount), passengersPerFlight + 1 + i / flightCount,
+                                                       "Benchmark " + to_string(i), "bench@example.com",
+                                                       phoneOf(passengerTotal + i), passenger, price);
+                book.add(start);
+                if(result == BOOKED) booked.push_back(passenger.ticketNumber);
+            }
+            writeBenchResult(cout, "book", book, false);
+            
+            shuffle(booked.begin(), booked.end(), rng);
+            LatencySamples cancel;
+            for(const auto& ticketNumber : booked) {
+                auto start = chrono::steady_clock::now();
+                system.cancelBooking(ticketNumber);
+                cancel.add(start);
+            }
+            writeBenchResult(cout, "cancel", cancel, false);
+            
+            // Parties of four placed into the same free seats, one journal record each
+            const int groupSize = 4;
+            int groups = static_cast<int>(min<long long>(lookups / 10, 1LL * flightCount * ((layout->seatCount - passengersPerFlight) / groupSize)));
+            booked.clear();
+            LatencySamples bookGroup;
+            for(int i = 0; i < groups; i++) {
+                GroupBooking group;
+                group.flightNumber = flightNumberOf(i % flightCount);
+                for(int j = 0; j < groupSize; j++) {
+                    Passenger member;
+                    member.name = "Group " + to_string(i) + "-" + to_string(j);
+                    member.email = "bench@example.com";
+                    member.phone = phoneOf(passengerTotal + i);
+                    group.party.push_back(member);
+                }
+                auto start = chrono::steady_clock::now();
+                BookingResult result = system.bookGroup(group);
+                bookGroup.add(start);
+                if(result == BOOKED) {
+                    for(const auto& member : group.party) booked.push_back(member.ticketNumber);
+                }
+            }
+            for(const auto& ticketNumber : booked) {
+                system.cancelBooking(ticketNumber);
+            }
+            writeBenchResult(cout, "book-group", bookGroup, false);
+            
+            // One flight filled up with a long waitlist behind it; every
+            // cancellation hands its seat on, and the new ticket is cancelled in turn
+            const int waitlisted = lookups / 10;
+            deque<string> promotable;
+            for(int seat = passengersPerFlight + 1; seat <= layout->seatCount; seat++) {
+                Passenger passenger;
+                double price;
+                if(system.bookSeat(flightNumberOf(0), seat, "Full " + to_string(seat), "bench@example.com",
+                                   phoneOf(passengerTotal + seat), passenger, price) == BOOKED) {
+                    promotable.push_back(passenger.ticketNumber);
+                }
+            }
+            for(int i = 0; i < waitlisted; i++) {
+                WaitlistEntry entry;
+                size_t position;
+                system.joinWaitlist(flightNumberOf(0), layout->cabinOf(layout->seatCount).type, "Waiting " + to_string(i),
+                                    "bench@example.com", phoneOf(passengerTotal + layout->seatCount + i), entry, position);
+            }
+            LatencySamples promote;
+            for(int i = 0; i < waitlisted && !promotable.empty(); i++) {
+                string promotedTicket;
+                auto start = chrono::steady_clock::now();
+                system.cancelBooking(promotable.front(), promotedTicket);
+                promote.add(start);
+                promotable.pop_front();
+                if(!promotedTicket.empty()) promotable.push_back(promotedTicket);
+            }
+            for(const auto& ticketNumber : promotable) {
+                system.cancelBooking(ticketNumber);
+            }
+            writeBenchResult(cout, "cancel-promote", promote, false);
+            
+            system.setDurabilityPolicy(SYNC_COMMIT);
+            LatencySamples bookSync;
+            booked.clear();
+            for(int i = 0; i < min(bookings, lookups / 100); i++) {
+                Passenger passenger;
+                double price;
+                auto start = chrono::steady_clock::now();
+                BookingResult result = system.bookSeat(flightNumberOf(i % flightCount), passengersPerFlight + 1 + i / flightCount,
+                                                       "Benchmark " + to_string(i), "bench@example.com",
+                                                       phoneOf(passengerTotal + i), passenger, price);
+                bookSync.add(start);
+                if(result == BOOKED) booked.push_back(passenger.ticketNumber);
+            }
+            system.setDurabilityPolicy(ASYNC_COMMIT);
+            for(const auto& ticketNumber : booked) {
+                system.cancelBooking(ticketNumber);
+            }
+            writeBenchResult(cout, "book-sync", bookSync, false);
+            
+            LatencySamples history;
+            long long holders = max(1LL, passengerTotal / historySize);
+            for(int i = 0; i < lookups; i++) {
+                auto start = chrono::steady_clock::now();
+                found += system.bookingHistoryOf(phoneOf(rng() % holders)).size();
+                history.add(start);
+            }
+            writeBenchResult(cout, "history", history, true);
+            
+            cout << "  ],\n";
+            cout << "  \"persistence\": {\"fullSnapshotBytes\": " << fullSnapshotBytes
+                 << ", \"checkpointBytesPerMutation\": " << fixed << setprecision(0) << checkpointBytes << "}\n";
+            cout << "}" << endl;
+            benchmarkSink = found;
+            return true;
+        }
+        
+        // Dataset generator - writes flightCount flights to flights.txt and their passengers'
+        // booking history to bookingHistory.txt. Each flight's occupancy is drawn around
+        // loadFactor and each phone number holds about historySize tickets. The same seed
+        // always produces the same files. Flights are streamed out one at a time so only
+        // the ticket-to-phone mapping for the history file is kept in memory.
+        bool generateDataset(int flightCount, double loadFactor, int historySize, uint64_t seed) {
+            static const char* airportNames[] = {
+                "Delhi", "Mumbai", "Bangalore", "Chennai", "Kolkata", "Hyderabad", "Pune", "Ahmedabad",
+                "Jaipur", "Lucknow", "Goa", "Kochi", "Guwahati", "Patna", "Bhopal", "Indore",
+                "Nagpur", "Srinagar", "Amritsar", "Varanasi", "Thiruvananthapuram", "Coimbatore",
+                "Bhubaneswar", "Ranchi", "Chandigarh", "Dehradun", "Visakhapatnam", "Madurai",
+                "Mangalore", "Udaipur", "Dubai", "Singapore", "London", "Bangkok", "Kathmandu", "Colombo"
+            };
+            static const char* hubs[] = { "Delhi", "Mumbai", "Bangalore", "Hyderabad" };
+            static const char* firstNames[] = {
+                "Aarav", "Vivaan", "Aditya", "Arjun", "Sai", "Ishaan", "Rohan", "Kabir", "Ananya", "Diya",
+                "Priya", "Kavya", "Meera", "Saanvi", "Aisha", "Riya", "Neha", "Rahul", "Vikram", "Sneha"
+            };
+            static const char* lastNames[] = {
+                "Sharma", "Verma", "Patel", "Reddy", "Iyer", "Nair", "Gupta", "Singh", "Khan", "Das",
+                "Mehta", "Joshi", "Rao", "Kapoor", "Bose", "Menon", "Pillai", "Chopra", "Malhotra", "Yadav"
+            };
+            static const char* layoutIds[] = { "A320", "A320", "A320", "A320", "A321", "A321", "A321", "B787", "B787", "B777" };
+            static const int daysInMonth[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+            const int airportCount = sizeof(airportNames) / sizeof(airportNames[0]);
+            const int scheduleDays = 90;
+            
+            mt19937_64 rng(seed);
+            auto pick = [&](int count) { return static_cast<int>(rng() % count); };
+            auto uniform = [&](double low, double high) {
+                return low + (high - low) * (rng() >> 11) * (1.0 / 9007199254740992.0);
+            };
+            
+            ofstream flightFile("flights.txt");
+            if(!flightFile.is_open()) {
+                cerr << "Error writing flights.txt!" << endl;
+                return false;
+            }
+            OutputBuffer flightOut(flightFile);
+            
+            // Phone numbers are handed out up front from the expected passenger count
+            double averageSeats = 0;
+            for(const char* id : layoutIds) averageSeats += seatLayouts().find(id)->seatCount;
+            averageSeats /= sizeof(layoutIds) / sizeof(layoutIds[0]);
+            historySize = max(1, historySize);
+            uint64_t holderCount = max<uint64_t>(1, static_cast<uint64_t>(flightCount * averageSeats * loadFactor / historySize));
+            
+            vector<uint32_t> holderOf; // passenger -> phone holder, in ticket order
+            vector<uint32_t> slotOf;   // passenger -> flight slot, in ticket order
+            vector<int> seats;
+            PassengerStore passengers; // one flight's worth at a time
+            uint64_t passengerTotal = 0;
+            
+            for(int i = 0; i < flightCount; i++) {
+                // Half the routes touch a hub
+                string source = airportNames[pick(airportCount)];
+                string destination;
+                if(rng() % 2 == 0) {
+                    destination = hubs[pick(sizeof(hubs) / sizeof(hubs[0]))];
+                    if(rng() % 2 == 0) swap(source, destination);
+                }
+                while(destination.empty() || destination == source) destination = airportNames[pick(airportCount)];
+                
+                int day = pick(scheduleDays);
+                int month = 0;
+                while(day >= daysInMonth[month]) day -= daysInMonth[month++];
+                
+                int departure = pick(24 * 12) * 5;
+                int duration = 60 + pick(36) * 5;
+                
+                Flight flight;
+                flight.slot = static_cast<uint32_t>(i + 1);
+                flight.flightNumber = "GN" + to_string(100000 + i);
+                flight.source = airports().intern(source);
+                flight.destination = airports().intern(destination);
+                flight.sourceTime = FlightTime(departure);
+                flight.destinationTime = FlightTime((departure + duration) % (24 * 60));
+                flight.date = FlightDate::fromCivil(2025, month + 1, day + 1);
+                flight.basePrice = 2500 + pick(190) * 50;
+                
+                // Mostly nonstop, some one-stop and a few two-stop itineraries
+                int stopRoll = pick(100);
+                flight.stops = stopRoll < 75 ? 0 : (stopRoll < 95 ? 1 : 2);
+                string via;
+                for(int stop = 0; stop < flight.stops; stop++) {
+                    string stopName;
+                    while(stopName.empty() || stopName == source || stopName == destination) {
+                        stopName = airportNames[pick(airportCount)];
+                    }
+                    via += (stop ? "-" : "") + stopName;
+                }
+                flight.via = airports().intern(via);
+                
+                int statusRoll = pick(100);
+                flight.status = statusRoll < 85 ? ON_TIME : (statusRoll < 97 ? DELAYED : CANCELED);
+                flight.setLayout(seatLayouts().find(layoutIds[pick(sizeof(layoutIds) / sizeof(layoutIds[0]))]));
+                
+                // Occupancy varies from flight to flight around the requested load factor
+                double occupancy = min(1.0, max(0.0, loadFactor + uniform(-0.15, 0.15)));
+                int booked = static_cast<int>(flight.seatCount * occupancy + 0.5);
+                
+                seats.resize(flight.seatCount);
+                for(int seat = 0; seat < flight.seatCount; seat++) seats[seat] = seat + 1;
+                
+                flight.passengers.reserve(booked);
+                for(int j = 0; j < booked; j++) {
+                    swap(seats[j], seats[j + pick(flight.seatCount - j)]);
+                    
+                    uint32_t holder = static_cast<uint32_t>(rng() % holderCount);
+                    const char* firstName = firstNames[pick(sizeof(firstNames) / sizeof(firstNames[0]))];
+                    const char* lastName = lastNames[pick(sizeof(lastNames) / sizeof(lastNames[0]))];
+                    
+                    Passenger passenger;
+                    passenger.name = string(firstName) + " " + lastName;
+                    passenger.email = string(firstName) + "." + lastName + to_string(holder) + "@example.com";
+                    passenger.phone = to_string(9000000000ULL + holder);
+                    passenger.seatNumber = seats[j];
+                    passenger.ticketNumber = "TKT" + to_string(passengerTotal + 1) + "-" + to_string(flight.slot);
+                    transform(passenger.email.begin(), passenger.email.end(), passenger.email.begin(), ::tolower);
+                    
+                    flight.passengers.push_back(passengers.add(passenger));
+                    flight.markSeatBooked(seats[j]);
+                    holderOf.push_back(holder);
+                    slotOf.push_back(flight.slot);
+                    passengerTotal++;
+                }
+                
+                FlightBookingSystem::writeFlightText(flightOut, flight, passengers);
+                passengers.clear();
+            }
+            
+            flightOut.flush();
+            flightFile.close();
+            if(!flightFile) {
+                cerr << "Error writing flights.txt!" << endl;
+                return false;
+            }
+            
+            // Group tickets by phone holder with a counting sort over holderOf
+            vector<uint64_t> firstTicket(holderCount + 1, 0);
+            for(uint32_t holder : holderOf) firstTicket[holder + 1]++;
+            for(uint64_t holder = 0; holder < holderCount; holder++) firstTicket[holder + 1] += firstTicket[holder];
+            
+            vector<uint64_t> ticketsByHolder(holderOf.size());
+            vector<uint64_t> next(firstTicket.begin(), firstTicket.end() - 1);
+            for(uint64_t ticket = 0; ticket < holderOf.size(); ticket++) {
+                ticketsByHolder[next[holderOf[ticket]]++] = ticket;
+            }
+            
+            ofstream historyFile("bookingHistory.txt");
+            if(!historyFile.is_open()) {
+                cerr << "Error writing bookingHistory.txt!" << endl;
+                return false;
+            }
+            
+            OutputBuffer historyOut(historyFile);
+            vector<string> tickets;
+            for(uint64_t holder = 0; holder < holderCount; holder++) {
+                if(firstTicket[holder] == firstTicket[holder + 1]) continue;
+                
+                tickets.clear();
+                for(uint64_t k = firstTicket[holder]; k < firstTicket[holder + 1]; k++) {
+                    uint64_t ticket = ticketsByHolder[k];
+                    tickets.push_back("TKT" + to_string(ticket + 1) + "-" + to_string(slotOf[ticket]));
+                }
+                FlightBookingSystem::writeHistoryText(historyOut, to_string(9000000000ULL + holder), tickets);
+            }
+            
+            historyOut.flush();
+            historyFile.close();
+            if(!historyFile) {
+                cerr << "Error writing bookingHistory.txt!" << endl;
+                return false;
+            }
+            
+            cerr << "Generated " << flightCount << " flights and " << passengerTotal << " passengers. "
+                 << "Run with --import-text to load them." << endl;
+            return true;
+        }
+        
+        // --export-manifest and --export-flights: [table|csv|json] [file|-],
+        // and for the manifest an optional flight number
+        int exportReport(FlightBookingSystem& system, bool manifest, int argc, char* argv[]) {
+            ReportFormat format = CSV_REPORT;
+            if(argc > 2 && !parseReportFormat(argv[2], format)) {
+                cerr << "Unknown report format " << argv[2] << " (use table, csv or json)" << endl;
+                return 1;
+            }
+            
+            static const char* extensions[] = { ".txt", ".csv", ".json" };
+            string path = (argc > 3) ? argv[3] : string(manifest ? "manifest" : "flights") + extensions[format];
+            string flightNumber = (manifest && argc > 4) ? argv[4] : "";
+            
+            ofstream reportFile;
+            if(path != "-") {
+                reportFile.open(path, ios::binary);
+                if(!reportFile.is_open()) {
+                    cerr << "Cannot write " << path << endl;
+                    return 1;
+                }
+            }
+            
+            ostream& out = (path == "-") ? cout : reportFile;
+            ReportWriter report(out, format, manifest ? FlightBookingSystem::manifestColumns()
+                                                      : FlightBookingSystem::flightReportColumns());
+            if(manifest) {
+                if(!system.writeManifestReport(report, flightNumber)) {
+                    cerr << "Flight " << flightNumber << " not found" << endl;
+                    if(path != "-") {
+                        reportFile.close();
+                        remove(path.c_str());
+                    }
+                    return 1;
+                }
+            } else {
+                system.writeFlightReport(report);
+            }
+            
+            if(!report.finish()) {
+                cerr << "Error writing " << path << endl;
+                return 1;
+            }
+            if(path != "-") {
+                cout << "Exported " << report.rowCount() << (manifest ? " bookings" : " flights") << " to " << path << "." << endl;
+            }
+            return 0;
+        }
+        
+        int main(int argc, char* argv[]) {
+            // Headless mode - read commands from a file or stdin, write results to stdout
+            if(argc > 1 && string(argv[1]) == "--batch") {
+                FlightBookingSystem system;
+                if(!system.isLoaded()) return 1;
+                if(argc > 2 && string(argv[2]) != "-") {
+                    ifstream commands(argv[2]);
+                    if(!commands.is_open()) {
+                        cerr << "Cannot open command file " << argv[2] << endl;
+                        return 1;
+                    }
+                    system.runCommands(commands, cout);
+                } else {
+                    system.runCommands(cin, cout);
+                }
+                return 0;
+            }
+            
+            if(argc > 1 && string(argv[1]) == "--bench-ticket-index") {
+                // Sizes grow tenfold from 1000, so the cap keeps them well inside size_t
+                long long maxPassengers = 0;
+                bool parsed = true;
+                try {
+                    maxPassengers = (argc > 2) ? stoll(argv[2]) : 10000000;
+                } catch(const exception&) {
+                    parsed = false;
+                }
+                if(!parsed || maxPassengers < 1000 || maxPassengers > 1000000000) {
+                    cout << "Usage: " << argv[0] << " --bench-ticket-index [max 1000-1000000000]" << endl;
+                    return 1;
+                }
+                benchmarkTicketIndex(static_cast<size_t>(maxPassengers));
+                return 0;
+            }
+            
+            if(argc > 1 && string(argv[1]) == "--bench") {
+                int flightCount = 0, passengersPerFlight = 0, historySize = 0;
+                bool parsed = true;
+                try {
+                    flightCount = (argc > 2) ? stoi(argv[2]) : 1000;
+                    passengersPerFlight = (argc > 3) ? stoi(argv[3]) : 100;
+                    historySize = (argc > 4) ? stoi(argv[4]) : 5;
+                } catch(const exception&) {
+                    parsed = false;
+                }
+                if(!parsed || flightCount < 1 || passengersPerFlight < 1 || historySize < 1) {
+                    cout << "Usage: " << argv[0] << " --bench [flights >= 1] [passengers >= 1] [history >= 1] [dir]" << endl;
+                    return 1;
+                }
+                string workDir = (argc > 5) ? argv[5] : "bench-data";
+                return runBenchmarks(flightCount, passengersPerFlight, historySize, workDir) ? 0 : 1;
+            }
+            
+            if(argc > 1 && string(argv[1]) == "--generate") {
+                int flightCount = 0, historySize = 0;
+                double loadFactor = 0;
+                uint64_t seed = 1;
+                bool parsed = true;
+                try {
+                    flightCount = (argc > 2) ? stoi(argv[2]) : 10000;
+                    loadFactor = (argc > 3) ? stod(argv[3]) : 0.8;
+                    historySize = (argc > 4) ? stoi(argv[4]) : 3;
+                    seed = (argc > 5) ? stoull(argv[5]) : 1;
+                } catch(const exception&) {
+                    parsed = false;
+                }
+                if(!parsed || flightCount < 1 || !(loadFactor > 0 && loadFactor <= 1) || historySize < 1) {
+                    cout << "Usage: " << argv[0] << " --generate [flights >= 1] [load 0-1] [history >= 1] [seed]" << endl;
+                    return 1;
+                }
+                return generateDataset(flightCount, loadFactor, historySize, seed) ? 0 : 1;
+            }
+            
+            if(argc > 1 && string(argv[1]) == "--stress") {
+                int maxThreads = 0, flightCount = 0, attemptsPerThread = 0;
+                bool parsed = true;
+                try {
+                    maxThreads = (argc > 2) ? stoi(argv[2]) : max(1u, thread::hardware_concurrency());
+                    flightCount = (argc > 3) ? stoi(argv[3]) : 200;
+                    attemptsPerThread = (argc > 4) ? stoi(argv[4]) : 200000;
+                } catch(const exception&) {
+                    parsed = false;
+                }
+                if(!parsed || maxThreads < 1 || flightCount < 1 || attemptsPerThread < 0) {
+                    cout << "Usage: " << argv[0] << " --stress [threads >= 1] [flights >= 1] [attempts >= 0]" << endl;
+                    return 1;
+                }
+                return runStressTest(maxThreads, flightCount, attemptsPerThread) ? 0 : 1;
+            }
+            
+            // Check the option before loading anything, so a typo or --help does
+            // not load the data and checkpoint it again on the way out
+            string option = (argc > 1) ? argv[1] : "";
+            if(argc > 1 && option != "--export-text" && option != "--import-text" && option != "--export-tickets" &&
+               option != "--export-manifest" && option != "--export-flights") {
+                cout << "Usage: " << argv[0] << " [--batch [file] | --export-text | --import-text | --export-tickets [file]"
+                     << " | --export-manifest [format] [file] [flight] | --export-flights [format] [file]"
+                     << " | --bench-ticket-index [max]"
+                     << " | --bench [flights] [passengers] [history] [dir]"
+                     << " | --generate [flights] [load] [history] [seed]"
+                     << " | --stress [threads] [flights] [attempts]]" << endl;
+                return 1;
+            }
+            
             FlightBookingSystem system;
+            if(!system.isLoaded() && option != "--import-text") return 1;
+            
+            if(argc > 1) {
+                if(option == "--export-text") {
+                    return system.exportText() ? 0 : 1;
+                } else if(option == "--import-text") {
+                    system.importText();
+                    return 0;
+                } else if(option == "--export-tickets") {
+                    string path = (argc > 2) ? argv[2] : "tickets.txt";
+                    if(path == "-") {
+                        system.exportTickets(cout);
+                        return cout ? 0 : 1;
+                    }
+                    
+                    ofstream ticketFile(path);
+                    if(!ticketFile.is_open()) {
+                        cerr << "Cannot write " << path << endl;
+                        return 1;
+                    }
+                    size_t exported = system.exportTickets(ticketFile);
+                    ticketFile.close();
+                    if(!ticketFile) {
+                        cerr << "Error writing " << path << endl;
+                        return 1;
+                    }
+                    cout << "Exported " << exported << " tickets to " << path << "." << endl;
+                    return 0;
+                } else {
+                    return exportReport(system, option == "--export-manifest", argc, argv);
+                }
+            }
+            
             system.mainMenu();
             return 0;
         }
\ No newline at end of file